@@ -0,0 +1,195 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ndi-audio.h"
+
+// SSE2 on x86, mapped to NEON through SIMDe on ARM
+#include <util/sse-intrin.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Channel routing
+
+static const char *skip_spaces(const char *p)
+{
+	while (isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+// One entry up to the next ',' or the end. Returns nullptr on errors.
+static const char *parse_route(const char *p, ndi_audio_route_t *route)
+{
+	*route = {};
+	route->gain = 1.0f;
+
+	p = skip_spaces(p);
+	if (*p == '-') {
+		// Silence
+		return skip_spaces(p + 1);
+	}
+
+	for (;;) {
+		char *end;
+		long channel = strtol(p, &end, 10);
+		if (end == p || channel < 1 || channel > UINT16_MAX ||
+		    route->source_count == NDI_AUDIO_MAX_ROUTE_SOURCES)
+			return nullptr;
+		route->sources[route->source_count++] =
+			(uint16_t)(channel - 1);
+
+		p = skip_spaces(end);
+		if (*p != '+')
+			break;
+		p++;
+	}
+
+	if (*p == '@') {
+		char *end;
+		double db = strtod(p + 1, &end);
+		if (end == p + 1)
+			return nullptr;
+		route->gain = (float)pow(10.0, db / 20.0);
+		p = skip_spaces(end);
+		if (strncmp(p, "dB", 2) == 0 || strncmp(p, "db", 2) == 0)
+			p = skip_spaces(p + 2);
+	}
+
+	return p;
+}
+
+bool ndi_audio_matrix_parse(const char *text, ndi_audio_matrix_t *matrix)
+{
+	*matrix = {};
+	const char *p = skip_spaces(text ? text : "");
+	if (!*p)
+		return true;
+
+	ndi_audio_matrix_t parsed = {};
+	for (;;) {
+		if (parsed.outputs == NDI_AUDIO_MAX_OUTPUTS)
+			return false;
+		p = parse_route(p, &parsed.routes[parsed.outputs++]);
+		if (!p)
+			return false;
+		if (!*p)
+			break;
+		if (*p != ',')
+			return false;
+		p++;
+	}
+
+	// OBS has speaker layouts for 1-6 and 8 channels, with 7 it would
+	// drop the audio: add a silent 8th
+	if (parsed.outputs == 7) {
+		ndi_audio_route_t *route = &parsed.routes[parsed.outputs++];
+		*route = {};
+		route->gain = 1.0f;
+	}
+
+	*matrix = parsed;
+	return true;
+}
+
+bool ndi_audio_matrix_equals(const ndi_audio_matrix_t *a,
+			     const ndi_audio_matrix_t *b)
+{
+	if (a->outputs != b->outputs)
+		return false;
+
+	for (uint32_t i = 0; i < a->outputs; i++) {
+		const ndi_audio_route_t *ra = &a->routes[i];
+		const ndi_audio_route_t *rb = &b->routes[i];
+		if (ra->source_count != rb->source_count ||
+		    ra->gain != rb->gain ||
+		    memcmp(ra->sources, rb->sources,
+			   ra->source_count * sizeof(ra->sources[0])) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Mix kernels
+
+static void scale_sse(const float *src, float gain, float *dst,
+		      uint32_t count)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	uint32_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128 a = _mm_loadu_ps(src + x);
+		__m128 b = _mm_loadu_ps(src + x + 4);
+		_mm_storeu_ps(dst + x, _mm_mul_ps(a, g));
+		_mm_storeu_ps(dst + x + 4, _mm_mul_ps(b, g));
+	}
+	for (; x < count; x++)
+		dst[x] = src[x] * gain;
+}
+
+static void mix_sse(const float *src, float gain, float *dst, uint32_t count)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	uint32_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128 a = _mm_loadu_ps(src + x);
+		__m128 b = _mm_loadu_ps(src + x + 4);
+		__m128 da = _mm_loadu_ps(dst + x);
+		__m128 db = _mm_loadu_ps(dst + x + 4);
+		_mm_storeu_ps(dst + x, _mm_add_ps(da, _mm_mul_ps(a, g)));
+		_mm_storeu_ps(dst + x + 4, _mm_add_ps(db, _mm_mul_ps(b, g)));
+	}
+	for (; x < count; x++)
+		dst[x] += src[x] * gain;
+}
+
+void ndi_audio_matrix_apply(const ndi_audio_matrix_t *matrix,
+			    const uint8_t *input, uint32_t channel_stride,
+			    uint32_t channels, uint32_t frames, float *buffer,
+			    const float **planes)
+{
+	for (uint32_t o = 0; o < matrix->outputs; o++) {
+		const ndi_audio_route_t *route = &matrix->routes[o];
+		float *out = buffer + (size_t)frames * o;
+
+		const float *sources[NDI_AUDIO_MAX_ROUTE_SOURCES];
+		int count = 0;
+		for (int i = 0; i < route->source_count; i++) {
+			if (route->sources[i] < channels)
+				sources[count++] =
+					(const float *)(input +
+							(size_t)channel_stride *
+								route->sources[i]);
+		}
+
+		if (count == 1 && route->gain == 1.0f) {
+			planes[o] = sources[0];
+			continue;
+		}
+
+		planes[o] = out;
+		if (!count) {
+			memset(out, 0, frames * sizeof(float));
+			continue;
+		}
+		scale_sse(sources[0], route->gain, out, frames);
+		for (int i = 1; i < count; i++)
+			mix_sse(sources[i], route->gain, out, frames);
+	}
+}
@@ -0,0 +1,63 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Audio channels OBS takes
+#define NDI_AUDIO_MAX_OUTPUTS 8
+// NDI channels one OBS channel can be mixed from
+#define NDI_AUDIO_MAX_ROUTE_SOURCES 4
+
+// One OBS channel: the sum of up to NDI_AUDIO_MAX_ROUTE_SOURCES NDI
+// channels times gain. No sources is silence.
+typedef struct {
+	uint16_t sources[NDI_AUDIO_MAX_ROUTE_SOURCES];
+	uint8_t source_count;
+	float gain;
+} ndi_audio_route_t;
+
+// Which NDI channels go to which OBS channels. Fixed size, so that configs
+// holding it can be copied around freely.
+typedef struct {
+	// 0 passes the first NDI_AUDIO_MAX_OUTPUTS channels through as they
+	// are
+	uint32_t outputs;
+	ndi_audio_route_t routes[NDI_AUDIO_MAX_OUTPUTS];
+} ndi_audio_matrix_t;
+
+// Parses a routing table: one comma separated entry per OBS channel, each
+// the 1-based NDI channels to sum joined by '+', optionally followed by
+// '@' and a gain in dB, or '-' for silence, e.g. "9,10" or "1+2@-6,-,3".
+// Empty text is pass-through. Seven entries get a silent eighth, as OBS
+// has no layout for seven channels. Returns false on syntax errors,
+// leaving *matrix pass-through.
+bool ndi_audio_matrix_parse(const char *text, ndi_audio_matrix_t *matrix);
+bool ndi_audio_matrix_equals(const ndi_audio_matrix_t *a,
+			     const ndi_audio_matrix_t *b);
+
+// Routes frames of planar float audio, channels planes channel_stride bytes
+// apart, to matrix->outputs planes. Outputs that are a single channel at
+// unity gain point into input, the others get mixed into buffer, which has
+// to hold frames floats per output. Channels the sender doesn't have are
+// silent.
+void ndi_audio_matrix_apply(const ndi_audio_matrix_t *matrix,
+			    const uint8_t *input, uint32_t channel_stride,
+			    uint32_t channels, uint32_t frames, float *buffer,
+			    const float **planes);
@@ -0,0 +1,96 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ndi-clock.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Arrival further off than this means the sender's clock jumped (e.g. a
+// timecode reset) rather than drifted, the loop starts over
+#define NDI_CLOCK_RELOCK_NS 500000000.0
+// Sender frames more than this apart don't say much about drift
+#define NDI_CLOCK_MAX_GAP_NS 5000000000LL
+// Bounds of the drift estimate, far beyond any real oscillator
+#define NDI_CLOCK_MAX_DRIFT_PPM 1000.0
+// Bound of the phase correction, so that mapped times never move faster
+// or slower than this compared to the sender's
+#define NDI_CLOCK_MAX_SLEW_PPM 2000.0
+// Loop gains per frame. Damping is about 0.7, the loop settles within a
+// couple of thousand frames and then barely reacts to single late ones.
+#define NDI_CLOCK_PHASE_GAIN (1.0 / 128.0)
+#define NDI_CLOCK_RATE_GAIN (1.0 / 32768.0)
+
+void ndi_clock_reset(ndi_clock_t *clock)
+{
+	*clock = {};
+	clock->rate = 1.0;
+}
+
+static uint64_t ndi_clock_lock(ndi_clock_t *clock, int64_t sender_ns,
+			       uint64_t arrival_ns)
+{
+	if (clock->locked)
+		clock->relocks++;
+	// Keep the drift estimate, the oscillators didn't change
+	if (clock->rate == 0.0)
+		clock->rate = 1.0;
+	clock->locked = true;
+	clock->sender_ns = sender_ns;
+	clock->local_ns = (double)arrival_ns;
+	return arrival_ns;
+}
+
+uint64_t ndi_clock_update(ndi_clock_t *clock, int64_t sender_ns,
+			  uint64_t arrival_ns)
+{
+	if (!clock->locked)
+		return ndi_clock_lock(clock, sender_ns, arrival_ns);
+
+	const int64_t elapsed = sender_ns - clock->sender_ns;
+	const double predicted = clock->local_ns + elapsed * clock->rate;
+	const double error = (double)arrival_ns - predicted;
+
+	if (elapsed > NDI_CLOCK_MAX_GAP_NS ||
+	    std::fabs(error) > NDI_CLOCK_RELOCK_NS)
+		return ndi_clock_lock(clock, sender_ns, arrival_ns);
+
+	// Frames of other streams of the sender may come slightly out of
+	// order, map them without disturbing the loop
+	if (elapsed <= 0)
+		return (uint64_t)std::max(predicted, 0.0);
+
+	const double max_step = elapsed * NDI_CLOCK_MAX_SLEW_PPM / 1000000.0;
+	const double step = std::clamp(error * NDI_CLOCK_PHASE_GAIN, -max_step,
+				       max_step);
+
+	const double max_rate = NDI_CLOCK_MAX_DRIFT_PPM / 1000000.0;
+	clock->rate = std::clamp(clock->rate +
+					 error * NDI_CLOCK_RATE_GAIN / elapsed,
+				 1.0 - max_rate, 1.0 + max_rate);
+
+	clock->sender_ns = sender_ns;
+	clock->local_ns = predicted + step;
+	return (uint64_t)std::max(clock->local_ns, 0.0);
+}
+
+double ndi_clock_drift_ppm(const ndi_clock_t *clock)
+{
+	// Local time per sender time above 1 means the sender is slow
+	return clock->locked ? (1.0 / clock->rate - 1.0) * 1000000.0 : 0.0;
+}
@@ -0,0 +1,48 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Recovers a sender's clock from the arrival times of its frames, mapping
+// sender time onto os_gettime_ns(). A second order loop follows the
+// sender's clock rate (drift) and offset while averaging out network
+// jitter, so the mapped times advance as smoothly as the sender's.
+//
+// Not thread safe, meant to be owned by the thread receiving the frames.
+typedef struct {
+	bool locked;
+	// Last sender time and the local time it was mapped to
+	int64_t sender_ns;
+	double local_ns;
+	// Local nanoseconds per sender nanosecond
+	double rate;
+	// Times the sender's clock jumped and the loop started over
+	uint64_t relocks;
+} ndi_clock_t;
+
+// Forget the sender, the next frame locks the loop again
+void ndi_clock_reset(ndi_clock_t *clock);
+
+// Local time of sender_ns for a frame that arrived at arrival_ns
+uint64_t ndi_clock_update(ndi_clock_t *clock, int64_t sender_ns,
+			  uint64_t arrival_ns);
+
+// How much faster the sender's clock runs than the local one
+double ndi_clock_drift_ppm(const ndi_clock_t *clock);
@@ -0,0 +1,492 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ndi-convert.h"
+
+// SSE2 on x86, mapped to NEON through SIMDe on ARM
+#include <util/sse-intrin.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define NDI_CONVERT_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NDI_CONVERT_TARGET_AVX2
+#else
+#define NDI_CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef NDI_CONVERT_AVX2
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, then check the OS saves the YMM registers
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const bool use_avx2 = cpu_has_avx2();
+#endif
+
+static inline const uint16_t *line16(const uint8_t *plane, uint32_t stride,
+				     uint32_t y)
+{
+	return (const uint16_t *)(plane + (size_t)stride * y);
+}
+
+static inline uint16_t *line16(uint8_t *plane, uint32_t stride, uint32_t y)
+{
+	return (uint16_t *)(plane + (size_t)stride * y);
+}
+
+// Line averaging
+
+static void average_line_sse2(const uint16_t *a, const uint16_t *b,
+			      uint16_t *dst, uint32_t count, uint32_t *done)
+{
+	uint32_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_avg_epu16(va, vb));
+	}
+	*done = x;
+}
+
+#ifdef NDI_CONVERT_AVX2
+NDI_CONVERT_TARGET_AVX2
+static void average_line_avx2(const uint16_t *a, const uint16_t *b,
+			      uint16_t *dst, uint32_t count, uint32_t *done)
+{
+	uint32_t x = 0;
+	for (; x + 16 <= count; x += 16) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + x));
+		_mm256_storeu_si256((__m256i *)(dst + x),
+				    _mm256_avg_epu16(va, vb));
+	}
+	*done = x;
+}
+#endif
+
+void ndi_convert_average_line_u16(const uint16_t *a, const uint16_t *b,
+				  uint16_t *dst, uint32_t count)
+{
+	uint32_t x = 0;
+#ifdef NDI_CONVERT_AVX2
+	if (use_avx2)
+		average_line_avx2(a, b, dst, count, &x);
+#endif
+	uint32_t done = 0;
+	average_line_sse2(a + x, b + x, dst + x, count - x, &done);
+	x += done;
+
+	// Same rounding as pavgw
+	for (; x < count; x++)
+		dst[x] = (uint16_t)(((uint32_t)a[x] + b[x] + 1) >> 1);
+}
+
+void ndi_convert_average_line_u8(const uint8_t *a, const uint8_t *b,
+				 uint8_t *dst, uint32_t count)
+{
+	uint32_t x = 0;
+	for (; x + 16 <= count; x += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_avg_epu8(va, vb));
+	}
+	for (; x < count; x++)
+		dst[x] = (uint8_t)(((uint32_t)a[x] + b[x] + 1) >> 1);
+}
+
+// P216 -> P010 chroma
+
+void ndi_convert_p216_to_p010_chroma(const uint8_t *src_uv,
+				     uint32_t src_stride, uint8_t *dst_uv,
+				     uint32_t dst_stride, uint32_t width,
+				     uint32_t height)
+{
+	// One U and one V sample per two pixels, so one uint16 per pixel
+	const uint32_t count = (width + 1) & ~1u;
+	const uint32_t out_height = (height + 1) / 2;
+
+	for (uint32_t y = 0; y < out_height; y++) {
+		const uint16_t *a = line16(src_uv, src_stride, y * 2);
+		const uint16_t *b =
+			(y * 2 + 1 < height)
+				? line16(src_uv, src_stride, y * 2 + 1)
+				: a;
+		ndi_convert_average_line_u16(
+			a, b, line16(dst_uv, dst_stride, y), count);
+	}
+}
+
+// PA16 -> YA2L
+
+static inline void shift_line_sse2(const uint16_t *src, uint16_t *dst,
+				   uint32_t count)
+{
+	uint32_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_srli_epi16(v, 4));
+	}
+	for (; x < count; x++)
+		dst[x] = src[x] >> 4;
+}
+
+// U0 V0 U1 V1 ... to U0 U0 U1 U1 ... and V0 V0 V1 V1 ...
+static inline void split_chroma_line_sse2(const uint16_t *src, uint16_t *u,
+					  uint16_t *v, uint32_t width)
+{
+	const __m128i low_mask = _mm_set1_epi32(0x0000FFFF);
+
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m128i uv = _mm_srli_epi16(
+			_mm_loadu_si128((const __m128i *)(src + x)), 4);
+		__m128i vu = _mm_and_si128(uv, low_mask);
+		__m128i vv = _mm_srli_epi32(uv, 16);
+		vu = _mm_or_si128(vu, _mm_slli_epi32(vu, 16));
+		vv = _mm_or_si128(vv, _mm_slli_epi32(vv, 16));
+		_mm_storeu_si128((__m128i *)(u + x), vu);
+		_mm_storeu_si128((__m128i *)(v + x), vv);
+	}
+	for (; x < width; x += 2) {
+		uint16_t cu = src[x] >> 4;
+		uint16_t cv = src[x + 1] >> 4;
+		u[x] = cu;
+		v[x] = cv;
+		if (x + 1 < width) {
+			u[x + 1] = cu;
+			v[x + 1] = cv;
+		}
+	}
+}
+
+void ndi_convert_pa16_to_ya2l(const uint8_t *src, uint32_t src_stride,
+			      uint8_t *const dst[4], const uint32_t dst_stride[4],
+			      uint32_t width, uint32_t height)
+{
+	const uint8_t *src_y = src;
+	const uint8_t *src_uv = src_y + (size_t)src_stride * height;
+	const uint8_t *src_a = src_uv + (size_t)src_stride * height;
+
+	for (uint32_t y = 0; y < height; y++) {
+		shift_line_sse2(line16(src_y, src_stride, y),
+				line16(dst[0], dst_stride[0], y), width);
+		split_chroma_line_sse2(line16(src_uv, src_stride, y),
+				       line16(dst[1], dst_stride[1], y),
+				       line16(dst[2], dst_stride[2], y), width);
+		shift_line_sse2(line16(src_a, src_stride, y),
+				line16(dst[3], dst_stride[3], y), width);
+	}
+}
+
+// UYVY -> planar 4:2:2
+
+static void split_uyvy_line_sse2(const uint8_t *src, uint8_t *y_out,
+				 uint8_t *u_out, uint8_t *v_out, uint32_t width)
+{
+	const __m128i low_mask = _mm_set1_epi16(0x00FF);
+
+	uint32_t x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i p0 = _mm_loadu_si128((const __m128i *)(src + x * 2));
+		__m128i p1 =
+			_mm_loadu_si128((const __m128i *)(src + x * 2 + 16));
+
+		__m128i y = _mm_packus_epi16(_mm_srli_epi16(p0, 8),
+					     _mm_srli_epi16(p1, 8));
+		// U0 V0 U1 V1 ...
+		__m128i uv = _mm_packus_epi16(_mm_and_si128(p0, low_mask),
+					      _mm_and_si128(p1, low_mask));
+		__m128i u = _mm_packus_epi16(_mm_and_si128(uv, low_mask),
+					     _mm_setzero_si128());
+		__m128i v = _mm_packus_epi16(_mm_srli_epi16(uv, 8),
+					     _mm_setzero_si128());
+
+		_mm_storeu_si128((__m128i *)(y_out + x), y);
+		_mm_storel_epi64((__m128i *)(u_out + x / 2), u);
+		_mm_storel_epi64((__m128i *)(v_out + x / 2), v);
+	}
+	for (; x < width; x += 2) {
+		const uint8_t *p = src + x * 2;
+		u_out[x / 2] = p[0];
+		y_out[x] = p[1];
+		v_out[x / 2] = p[2];
+		if (x + 1 < width)
+			y_out[x + 1] = p[3];
+	}
+}
+
+void ndi_convert_uyvy_to_planar(const uint8_t *src, uint32_t src_stride,
+				uint8_t *const dst[3], const uint32_t dst_stride[3],
+				uint32_t width, uint32_t height)
+{
+	for (uint32_t y = 0; y < height; y++) {
+		split_uyvy_line_sse2(src + (size_t)src_stride * y,
+				     dst[0] + (size_t)dst_stride[0] * y,
+				     dst[1] + (size_t)dst_stride[1] * y,
+				     dst[2] + (size_t)dst_stride[2] * y, width);
+	}
+}
+
+// 2x2 box filters
+
+static inline uint8_t avg_u8(uint8_t a, uint8_t b)
+{
+	// Same rounding as pavgb
+	return (uint8_t)(((uint32_t)a + b + 1) >> 1);
+}
+
+static inline __m128i load_avg(const uint8_t *a, const uint8_t *b)
+{
+	return _mm_avg_epu8(_mm_loadu_si128((const __m128i *)a),
+			    _mm_loadu_si128((const __m128i *)b));
+}
+
+// Vertical average of byte i of a and b
+static inline uint8_t line_avg(const uint8_t *a, const uint8_t *b, size_t i)
+{
+	return avg_u8(a[i], b[i]);
+}
+
+void ndi_convert_halve_line_u8(const uint8_t *a, const uint8_t *b,
+			       uint8_t *dst, uint32_t count)
+{
+	const __m128i low_mask = _mm_set1_epi16(0x00FF);
+
+	uint32_t x = 0;
+	for (; x + 16 <= count; x += 16) {
+		__m128i v0 = load_avg(a + x * 2, b + x * 2);
+		__m128i v1 = load_avg(a + x * 2 + 16, b + x * 2 + 16);
+		__m128i h0 = _mm_avg_epu16(_mm_and_si128(v0, low_mask),
+					   _mm_srli_epi16(v0, 8));
+		__m128i h1 = _mm_avg_epu16(_mm_and_si128(v1, low_mask),
+					   _mm_srli_epi16(v1, 8));
+		_mm_storeu_si128((__m128i *)(dst + x),
+				 _mm_packus_epi16(h0, h1));
+	}
+	for (; x < count; x++)
+		dst[x] = avg_u8(line_avg(a, b, x * 2),
+				line_avg(a, b, x * 2 + 1));
+}
+
+void ndi_convert_halve_line_u16(const uint8_t *a, const uint8_t *b,
+				uint8_t *dst, uint32_t count)
+{
+	const __m128i low_mask = _mm_set1_epi32(0x0000FFFF);
+
+	uint32_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m128i v0 = load_avg(a + x * 4, b + x * 4);
+		__m128i v1 = load_avg(a + x * 4 + 16, b + x * 4 + 16);
+		// Even pairs in the low half of each 32-bit lane, odd pairs
+		// moved down next to them
+		__m128i h0 = _mm_avg_epu8(_mm_and_si128(v0, low_mask),
+					  _mm_srli_epi32(v0, 16));
+		__m128i h1 = _mm_avg_epu8(_mm_and_si128(v1, low_mask),
+					  _mm_srli_epi32(v1, 16));
+		// Sign extended so that the signed pack keeps the bits
+		h0 = _mm_srai_epi32(_mm_slli_epi32(h0, 16), 16);
+		h1 = _mm_srai_epi32(_mm_slli_epi32(h1, 16), 16);
+		_mm_storeu_si128((__m128i *)(dst + x * 2),
+				 _mm_packs_epi32(h0, h1));
+	}
+	for (; x < count; x++) {
+		for (uint32_t i = 0; i < 2; i++)
+			dst[x * 2 + i] = avg_u8(line_avg(a, b, x * 4 + i),
+						line_avg(a, b, x * 4 + 2 + i));
+	}
+}
+
+// Units 0 2 4 6 and 1 3 5 7 of two vectors of 32-bit units
+static inline void split_even_odd(__m128i v0, __m128i v1, __m128i *even,
+				  __m128i *odd)
+{
+	__m128 f0 = _mm_castsi128_ps(v0);
+	__m128 f1 = _mm_castsi128_ps(v1);
+	*even = _mm_castps_si128(
+		_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+	*odd = _mm_castps_si128(
+		_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+void ndi_convert_halve_line_u32(const uint8_t *a, const uint8_t *b,
+				uint8_t *dst, uint32_t count)
+{
+	uint32_t x = 0;
+	for (; x + 4 <= count; x += 4) {
+		__m128i even, odd;
+		split_even_odd(load_avg(a + x * 8, b + x * 8),
+			       load_avg(a + x * 8 + 16, b + x * 8 + 16), &even,
+			       &odd);
+		_mm_storeu_si128((__m128i *)(dst + x * 4),
+				 _mm_avg_epu8(even, odd));
+	}
+	for (; x < count; x++) {
+		for (uint32_t i = 0; i < 4; i++)
+			dst[x * 4 + i] = avg_u8(line_avg(a, b, x * 8 + i),
+						line_avg(a, b, x * 8 + 4 + i));
+	}
+}
+
+void ndi_convert_halve_line_uyvy(const uint8_t *a, const uint8_t *b,
+				 uint8_t *dst, uint32_t count)
+{
+	const __m128i chroma_mask = _mm_set1_epi32(0x00FF00FF);
+	const __m128i y0_mask = _mm_set1_epi32(0x0000FF00);
+	const __m128i y1_mask = _mm_set1_epi32((int)0xFF000000);
+
+	uint32_t x = 0;
+	for (; x + 4 <= count; x += 4) {
+		// Output macropixel x takes its chroma from input macropixels
+		// 2x and 2x + 1, and one luma sample from each of them
+		__m128i even, odd;
+		split_even_odd(load_avg(a + x * 8, b + x * 8),
+			       load_avg(a + x * 8 + 16, b + x * 8 + 16), &even,
+			       &odd);
+		__m128i uv = _mm_avg_epu8(even, odd);
+		__m128i y0 = _mm_avg_epu8(even, _mm_srli_epi32(even, 16));
+		__m128i y1 = _mm_avg_epu8(odd, _mm_srli_epi32(odd, 16));
+		__m128i out = _mm_or_si128(
+			_mm_and_si128(uv, chroma_mask),
+			_mm_or_si128(_mm_and_si128(y0, y0_mask),
+				     _mm_and_si128(_mm_slli_epi32(y1, 16),
+						   y1_mask)));
+		_mm_storeu_si128((__m128i *)(dst + x * 4), out);
+	}
+	for (; x < count; x++) {
+		const size_t i = (size_t)x * 8;
+		uint8_t *out = dst + x * 4;
+		out[0] = avg_u8(line_avg(a, b, i), line_avg(a, b, i + 4));
+		out[1] = avg_u8(line_avg(a, b, i + 1), line_avg(a, b, i + 3));
+		out[2] = avg_u8(line_avg(a, b, i + 2), line_avg(a, b, i + 6));
+		out[3] = avg_u8(line_avg(a, b, i + 5), line_avg(a, b, i + 7));
+	}
+}
+
+// Bilinear 32-bit pixels
+
+static inline __m128i load_pixel(const uint8_t *line, uint32_t x)
+{
+	uint32_t pixel;
+	memcpy(&pixel, line + (size_t)x * 4, 4);
+	return _mm_cvtsi32_si128((int)pixel);
+}
+
+// 16.16 source position of the first destination sample and the step
+// between two, lining up sample centers
+static inline void scale_steps(uint32_t src_size, uint32_t dst_size,
+			       int64_t *first, int64_t *step)
+{
+	*step = ((int64_t)src_size << 16) / dst_size;
+	*first = (*step - 65536) / 2;
+}
+
+// Splits a 16.16 position into a sample index, the next one and a 7-bit
+// weight for the latter, clamped to the edges
+static inline uint32_t scale_index(int64_t pos, uint32_t size, uint32_t *next,
+				   int *weight)
+{
+	if (pos < 0)
+		pos = 0;
+	uint32_t index = (uint32_t)(pos >> 16);
+	*weight = (int)((pos >> 9) & 0x7F);
+	if (index >= size - 1) {
+		index = size - 1;
+		*weight = 0;
+	}
+	*next = index + 1 < size ? index + 1 : index;
+	return index;
+}
+
+void ndi_convert_scale_u32(const uint8_t *src, uint32_t src_stride,
+			   uint32_t src_width, uint32_t src_height, uint8_t *dst,
+			   uint32_t dst_stride, uint32_t dst_width,
+			   uint32_t dst_height)
+{
+	if (!src_width || !src_height)
+		return;
+
+	const __m128i zero = _mm_setzero_si128();
+	int64_t x_first, x_step, y_first, y_step;
+	scale_steps(src_width, dst_width, &x_first, &x_step);
+	scale_steps(src_height, dst_height, &y_first, &y_step);
+
+	for (uint32_t y = 0; y < dst_height; y++) {
+		uint32_t y1;
+		int wy;
+		uint32_t y0 = scale_index(y_first + y_step * y, src_height, &y1,
+					  &wy);
+		const uint8_t *a = src + (size_t)src_stride * y0;
+		const uint8_t *b = src + (size_t)src_stride * y1;
+		const __m128i vy = _mm_set1_epi16((short)wy);
+		uint8_t *out = dst + (size_t)dst_stride * y;
+
+		int64_t pos = x_first;
+		for (uint32_t x = 0; x < dst_width; x++, pos += x_step) {
+			uint32_t x1;
+			int wx;
+			uint32_t x0 = scale_index(pos, src_width, &x1, &wx);
+
+			// Pixels x0 and x1 of both lines, 16 bits a channel
+			__m128i top = _mm_unpacklo_epi8(
+				_mm_unpacklo_epi32(load_pixel(a, x0),
+						   load_pixel(a, x1)),
+				zero);
+			__m128i bottom = _mm_unpacklo_epi8(
+				_mm_unpacklo_epi32(load_pixel(b, x0),
+						   load_pixel(b, x1)),
+				zero);
+			__m128i v = _mm_add_epi16(
+				top, _mm_srai_epi16(
+					     _mm_mullo_epi16(
+						     _mm_sub_epi16(bottom, top),
+						     vy),
+					     7));
+
+			// Then between the two pixels
+			__m128i right = _mm_unpackhi_epi64(v, v);
+			__m128i h = _mm_add_epi16(
+				v, _mm_srai_epi16(
+					   _mm_mullo_epi16(
+						   _mm_sub_epi16(right, v),
+						   _mm_set1_epi16((short)wx)),
+					   7));
+			uint32_t pixel =
+				(uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(h, h));
+			memcpy(out + (size_t)x * 4, &pixel, 4);
+		}
+	}
+}
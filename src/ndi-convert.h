@@ -0,0 +1,69 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Pixel conversion kernels used on the receive path. Widths and heights are
+// in pixels, strides in bytes. All kernels accept unaligned buffers.
+
+// Rounded average of two lines of 8 or 16-bit samples
+void ndi_convert_average_line_u8(const uint8_t *a, const uint8_t *b,
+				 uint8_t *dst, uint32_t count);
+void ndi_convert_average_line_u16(const uint16_t *a, const uint16_t *b,
+				  uint16_t *dst, uint32_t count);
+
+// P216 interleaved 4:2:2 chroma plane to P010 4:2:0 chroma plane, averaging
+// vertically adjacent lines. Luma is left alone: P216 luma is already a
+// valid (MSB aligned) P010 luma plane.
+void ndi_convert_p216_to_p010_chroma(const uint8_t *src_uv,
+				     uint32_t src_stride, uint8_t *dst_uv,
+				     uint32_t dst_stride, uint32_t width,
+				     uint32_t height);
+
+// PA16 (P216 followed by a 16-bit alpha plane) to the four LSB aligned
+// 12-bit planes of YA2L, upsampling chroma horizontally.
+void ndi_convert_pa16_to_ya2l(const uint8_t *src, uint32_t src_stride,
+			      uint8_t *const dst[4], const uint32_t dst_stride[4],
+			      uint32_t width, uint32_t height);
+
+// Packed UYVY to 4:2:2 planar Y, U and V planes
+void ndi_convert_uyvy_to_planar(const uint8_t *src, uint32_t src_stride,
+				uint8_t *const dst[3], const uint32_t dst_stride[3],
+				uint32_t width, uint32_t height);
+
+// 2x2 box filter of two adjacent lines into one line of count units: bytes,
+// 16-bit pairs (e.g. NV12 UV), 32-bit pixels (e.g. BGRA) or UYVY
+// macropixels, each output unit made of two input units. Lines are averaged
+// first, then units.
+void ndi_convert_halve_line_u8(const uint8_t *a, const uint8_t *b,
+			       uint8_t *dst, uint32_t count);
+void ndi_convert_halve_line_u16(const uint8_t *a, const uint8_t *b,
+				uint8_t *dst, uint32_t count);
+void ndi_convert_halve_line_u32(const uint8_t *a, const uint8_t *b,
+				uint8_t *dst, uint32_t count);
+void ndi_convert_halve_line_uyvy(const uint8_t *a, const uint8_t *b,
+				 uint8_t *dst, uint32_t count);
+
+// Bilinear resampling of 32-bit pixels (e.g. BGRA), with 7-bit weights.
+// Meant for ratios up to 2:1 down, reduce with the halving kernels first.
+void ndi_convert_scale_u32(const uint8_t *src, uint32_t src_stride,
+			   uint32_t src_width, uint32_t src_height, uint8_t *dst,
+			   uint32_t dst_stride, uint32_t dst_width,
+			   uint32_t dst_height);
@@ -0,0 +1,156 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+
+#include "ndi-dedup.h"
+
+// SSE2 on x86, mapped to NEON through SIMDe on ARM
+#include <util/sse-intrin.h>
+#include <string.h>
+
+// Bytes of frame's planes, which follow each other in memory
+static size_t frame_size(const NDIlib_video_frame_v2_t *frame)
+{
+	const size_t stride = (size_t)frame->line_stride_in_bytes;
+	const size_t height = (size_t)frame->yres;
+
+	switch (frame->FourCC) {
+	case NDIlib_FourCC_type_UYVA:
+		return stride * height + (size_t)frame->xres * height;
+	case NDIlib_FourCC_type_NV12:
+	case NDIlib_FourCC_type_I420:
+	case NDIlib_FourCC_type_YV12:
+		return stride * height + stride * ((height + 1) / 2);
+	case NDIlib_FourCC_type_P216:
+		return stride * height * 2;
+	case NDIlib_FourCC_type_PA16:
+		return stride * height * 3;
+	default:
+		return stride * height;
+	}
+}
+
+static inline __m128i rotl64_17(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi64(v, 17), _mm_srli_epi64(v, 47));
+}
+
+// Folds 16 bytes into two 64-bit lanes, XXH3 style. The rotation makes the
+// result depend on where data is, not only on what is there, so that e.g.
+// a flat box moving over a flat background still changes the hash.
+static inline __m128i accumulate(__m128i acc, __m128i data, __m128i key)
+{
+	__m128i keyed = _mm_xor_si128(data, key);
+	// Low times high 32 bits of each lane
+	__m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+	__m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+	return _mm_add_epi64(rotl64_17(acc), _mm_add_epi64(product, swapped));
+}
+
+static void hash_bytes(const uint8_t *data, size_t size, __m128i acc[2])
+{
+	const __m128i key0 = _mm_set_epi32((int)0x7c01812c, (int)0xf721ad1c,
+					   (int)0xded46de9, (int)0x839097db);
+	const __m128i key1 = _mm_set_epi32((int)0x1f67b3b7, (int)0xa4b22a75,
+					   (int)0x9a1d3b3f, (int)0x2e2e0e2b);
+
+	size_t x = 0;
+	for (; x + 32 <= size; x += 32) {
+		acc[0] = accumulate(
+			acc[0], _mm_loadu_si128((const __m128i *)(data + x)),
+			key0);
+		acc[1] = accumulate(
+			acc[1],
+			_mm_loadu_si128((const __m128i *)(data + x + 16)),
+			key1);
+	}
+
+	if (x < size) {
+		alignas(16) uint8_t tail[32] = {};
+		memcpy(tail, data + x, size - x);
+		acc[0] = accumulate(acc[0], _mm_load_si128((__m128i *)tail),
+				    key0);
+		acc[1] = accumulate(acc[1],
+				    _mm_load_si128((__m128i *)(tail + 16)),
+				    key1);
+	}
+}
+
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+uint64_t ndi_dedup_hash(const NDIlib_video_frame_v2_t *frame,
+			uint32_t line_step)
+{
+	const size_t stride = (size_t)frame->line_stride_in_bytes;
+	const size_t size = frame_size(frame);
+	if (!line_step)
+		line_step = 1;
+
+	__m128i acc[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+	if (stride == 0 || line_step == 1) {
+		hash_bytes(frame->p_data, size, acc);
+	} else {
+		// Lines of stride bytes through all planes, so every plane gets
+		// sampled
+		for (size_t offset = 0; offset < size;
+		     offset += stride * line_step) {
+			size_t bytes = size - offset < stride ? size - offset
+							      : stride;
+			hash_bytes(frame->p_data + offset, bytes, acc);
+		}
+	}
+
+	alignas(16) uint64_t lanes[4];
+	_mm_store_si128((__m128i *)lanes, acc[0]);
+	_mm_store_si128((__m128i *)(lanes + 2), acc[1]);
+
+	uint64_t h = mix64((uint64_t)frame->FourCC << 32 ^ size);
+	h = mix64(h ^ ((uint64_t)frame->xres << 32 | (uint32_t)frame->yres));
+	for (int i = 0; i < 4; i++)
+		h = mix64(h ^ lanes[i]);
+	return h;
+}
+
+bool ndi_dedup_is_repeat(ndi_dedup_t *dedup,
+			 const NDIlib_video_frame_v2_t *frame,
+			 uint32_t line_step, uint64_t now_ns)
+{
+	uint64_t hash = ndi_dedup_hash(frame, line_step);
+	if (dedup->has_last && hash == dedup->last_hash &&
+	    now_ns - dedup->last_output_ns < NDI_DEDUP_KEEPALIVE_NS)
+		return true;
+
+	dedup->last_hash = hash;
+	dedup->last_output_ns = now_ns;
+	dedup->has_last = true;
+	return false;
+}
+
+void ndi_dedup_reset(ndi_dedup_t *dedup)
+{
+	dedup->has_last = false;
+}
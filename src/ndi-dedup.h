@@ -0,0 +1,51 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+
+#pragma once
+
+#include <obs-module.h>
+
+#include "plugin-main.h"
+
+// A repeated frame is still let through this often, so that OBS keeps
+// seeing the source's timestamps advance
+#define NDI_DEDUP_KEEPALIVE_NS 500000000ULL
+
+// Spots frames that repeat the last one let through, e.g. from graphics or
+// slide senders sending the same picture at full frame rate. Not thread
+// safe, meant to be owned by the thread receiving the frames.
+typedef struct {
+	uint64_t last_hash;
+	uint64_t last_output_ns;
+	bool has_last;
+} ndi_dedup_t;
+
+// Hash of every line_step-th line of frame's planes (1 for all of them),
+// covering its format and size as well
+uint64_t ndi_dedup_hash(const NDIlib_video_frame_v2_t *frame,
+			uint32_t line_step);
+
+// Returns true if frame repeats the last frame let through and can be
+// skipped; false lets it through and remembers it
+bool ndi_dedup_is_repeat(ndi_dedup_t *dedup,
+			 const NDIlib_video_frame_v2_t *frame,
+			 uint32_t line_step, uint64_t now_ns);
+
+// Let the next frame through whatever it is
+void ndi_dedup_reset(ndi_dedup_t *dedup);
@@ -0,0 +1,485 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ndi-discovery.h"
+
+// Longest time the discovery thread waits for changes, spread over the
+// profiles. Also how often last_seen_ns moves on and how long stopping
+// can take.
+#define NDI_DISCOVERY_WAIT_MS 1000
+// Time cached sources have to show up once searching started
+#define NDI_DISCOVERY_CACHE_GRACE_NS 15000000000ULL
+// Cached sources not seen for longer than this aren't loaded
+#define NDI_DISCOVERY_CACHE_MAX_AGE_S (7 * 24 * 3600)
+#define NDI_DISCOVERY_CACHE_FILE "discovery-cache.json"
+#define NDI_DISCOVERY_PROFILES_FILE "discovery-profiles.json"
+
+static const char *ndi_discovery_signals[] = {
+	"void source_added(string ndi_name, string url_address)",
+	"void source_removed(string ndi_name)",
+	nullptr,
+};
+
+typedef struct {
+	std::string name;
+	std::string groups;
+	std::string extra_ips;
+	bool show_local_sources;
+	NDIlib_find_instance_t ndi_finder;
+} ndi_discovery_profile_t;
+
+typedef struct {
+	// Fixed between start and stop
+	std::vector<ndi_discovery_profile_t> profiles;
+
+	pthread_t thread;
+	bool thread_started;
+	std::atomic<bool> running;
+	signal_handler_t *signals;
+
+	// Protects the index
+	pthread_mutex_t mutex;
+	std::map<std::string, ndi_discovery_source_t> sources;
+
+	// Discovery thread only
+	uint64_t started_ns;
+	bool cache_reconciled;
+} ndi_discovery_t;
+
+static ndi_discovery_t discovery;
+
+static void ndi_discovery_signal(const char *signal, const char *ndi_name,
+				 const char *url_address)
+{
+	calldata_t cd;
+	calldata_init(&cd);
+	calldata_set_string(&cd, "ndi_name", ndi_name);
+	if (url_address)
+		calldata_set_string(&cd, "url_address", url_address);
+	signal_handler_signal(discovery.signals, signal, &cd);
+	calldata_free(&cd);
+}
+
+// Merge the current list of the profile's finder into the index, or only
+// the passing of time when changed is false, and signal the difference.
+// profile < 0 just drops the cached sources that never showed up.
+static void ndi_discovery_refresh(int profile, bool changed)
+{
+	const uint64_t now = os_gettime_ns();
+	const bool grace_over = now - discovery.started_ns >=
+				NDI_DISCOVERY_CACHE_GRACE_NS;
+	const uint32_t bit = profile >= 0 ? 1u << profile : 0;
+	std::vector<ndi_discovery_source_t> added;
+	std::vector<std::string> removed;
+
+	pthread_mutex_lock(&discovery.mutex);
+	if (!changed) {
+		// Everything the profile found is still around
+		for (auto &it : discovery.sources) {
+			if (it.second.live && (it.second.profiles & bit))
+				it.second.last_seen_ns = now;
+		}
+		pthread_mutex_unlock(&discovery.mutex);
+		return;
+	}
+
+	uint32_t count = 0;
+	const NDIlib_source_t *current = nullptr;
+	if (profile >= 0 && discovery.profiles[profile].ndi_finder) {
+		current = ndiLib->find_get_current_sources(
+			discovery.profiles[profile].ndi_finder, &count);
+	}
+
+	// Whatever the profile doesn't list anymore is lost to it
+	for (auto &it : discovery.sources) {
+		if (it.second.live)
+			it.second.profiles &= ~bit;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!current[i].p_ndi_name)
+			continue;
+
+		const char *url_address = current[i].p_url_address
+						  ? current[i].p_url_address
+						  : "";
+		auto found = discovery.sources.find(current[i].p_ndi_name);
+		if (found == discovery.sources.end()) {
+			ndi_discovery_source_t source = {};
+			source.ndi_name = current[i].p_ndi_name;
+			source.first_seen_ns = now;
+			found = discovery.sources
+					.emplace(current[i].p_ndi_name, source)
+					.first;
+			found->second.url_address = url_address;
+			added.push_back(found->second);
+		} else if (found->second.url_address != url_address) {
+			// Moved, or only known from the cache
+			found->second.url_address = url_address;
+			added.push_back(found->second);
+		}
+
+		ndi_discovery_source_t *source = &found->second;
+		if (!source->live) {
+			// The cache's idea of the profiles is history now
+			source->live = true;
+			source->profiles = 0;
+		}
+		source->profiles |= bit;
+		source->last_seen_ns = now;
+	}
+
+	for (auto it = discovery.sources.begin();
+	     it != discovery.sources.end();) {
+		const ndi_discovery_source_t *source = &it->second;
+		if ((source->live && !source->profiles) ||
+		    (!source->live && grace_over)) {
+			removed.push_back(it->first);
+			it = discovery.sources.erase(it);
+		} else {
+			++it;
+		}
+	}
+	pthread_mutex_unlock(&discovery.mutex);
+
+	for (auto &source : added) {
+		blog(LOG_DEBUG, "[obs-ndi] ndi_discovery: found '%s' (%s)",
+		     source.ndi_name.constData(),
+		     source.url_address.constData());
+		ndi_discovery_signal("source_added", source.ndi_name.constData(),
+				     source.url_address.constData());
+	}
+	for (auto &ndi_name : removed) {
+		blog(LOG_DEBUG, "[obs-ndi] ndi_discovery: lost '%s'",
+		     ndi_name.c_str());
+		ndi_discovery_signal("source_removed", ndi_name.c_str(),
+				     nullptr);
+	}
+}
+
+static void *ndi_discovery_thread(void *)
+{
+	os_set_thread_name("ndi-discovery");
+	blog(LOG_INFO, "[obs-ndi] +ndi_discovery_thread()");
+
+	discovery.started_ns = os_gettime_ns();
+	discovery.cache_reconciled = false;
+
+	const int count = (int)discovery.profiles.size();
+	const uint32_t wait_ms = NDI_DISCOVERY_WAIT_MS / (count ? count : 1);
+
+	for (int i = 0; i < count; i++)
+		ndi_discovery_refresh(i, true);
+
+	while (discovery.running) {
+		for (int i = 0; i < count && discovery.running; i++) {
+			NDIlib_find_instance_t ndi_finder =
+				discovery.profiles[i].ndi_finder;
+			if (!ndi_finder)
+				continue;
+			bool changed = ndiLib->find_wait_for_sources(ndi_finder,
+								     wait_ms);
+			ndi_discovery_refresh(i, changed);
+		}
+
+		// Drop what's left of the cache once, even without a change
+		if (!discovery.cache_reconciled &&
+		    os_gettime_ns() - discovery.started_ns >=
+			    NDI_DISCOVERY_CACHE_GRACE_NS) {
+			discovery.cache_reconciled = true;
+			ndi_discovery_refresh(-1, true);
+		}
+
+		if (!count)
+			os_sleep_ms(NDI_DISCOVERY_WAIT_MS);
+	}
+
+	blog(LOG_INFO, "[obs-ndi] -ndi_discovery_thread()");
+	return nullptr;
+}
+
+static void ndi_discovery_load_profiles()
+{
+	char *path = obs_module_config_path(NDI_DISCOVERY_PROFILES_FILE);
+	obs_data_t *data = obs_data_create_from_json_file_safe(path, "bak");
+	bfree(path);
+
+	obs_data_array_t *array = data ? obs_data_get_array(data, "profiles")
+				       : nullptr;
+	size_t count = obs_data_array_count(array);
+	for (size_t i = 0; i < count && discovery.profiles.size() <
+						NDI_DISCOVERY_MAX_PROFILES;
+	     i++) {
+		obs_data_t *item = obs_data_array_item(array, i);
+		obs_data_set_default_bool(item, "show_local_sources", true);
+
+		ndi_discovery_profile_t profile = {};
+		profile.name = obs_data_get_string(item, "name");
+		profile.groups = obs_data_get_string(item, "groups");
+		profile.extra_ips = obs_data_get_string(item, "extra_ips");
+		profile.show_local_sources =
+			obs_data_get_bool(item, "show_local_sources");
+		if (profile.name.empty())
+			profile.name = "Profile " + std::to_string(i + 1);
+		discovery.profiles.push_back(profile);
+		obs_data_release(item);
+	}
+	obs_data_array_release(array);
+	obs_data_release(data);
+
+	if (discovery.profiles.empty()) {
+		ndi_discovery_profile_t profile = {};
+		profile.name = obs_module_text("NDIPlugin.Default");
+		profile.show_local_sources = true;
+		discovery.profiles.push_back(profile);
+	}
+}
+
+static void ndi_discovery_load_cache()
+{
+	char *path = obs_module_config_path(NDI_DISCOVERY_CACHE_FILE);
+	obs_data_t *data = obs_data_create_from_json_file_safe(path, "bak");
+	bfree(path);
+	if (!data)
+		return;
+
+	const uint64_t now = os_gettime_ns();
+	const int64_t wall_now = (int64_t)time(nullptr);
+
+	obs_data_array_t *array = obs_data_get_array(data, "sources");
+	size_t count = obs_data_array_count(array);
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *item = obs_data_array_item(array, i);
+		const char *ndi_name = obs_data_get_string(item, "name");
+		int64_t age_s = wall_now - obs_data_get_int(item, "last_seen");
+
+		if (*ndi_name && age_s >= 0 &&
+		    age_s <= NDI_DISCOVERY_CACHE_MAX_AGE_S) {
+			uint64_t age_ns = (uint64_t)age_s * 1000000000ULL;
+			ndi_discovery_source_t source = {};
+			source.ndi_name = ndi_name;
+			source.url_address = obs_data_get_string(item, "url");
+			source.last_seen_ns = age_ns < now ? now - age_ns : 0;
+			source.first_seen_ns = source.last_seen_ns;
+			source.live = false;
+			source.profiles = 0;
+
+			// Profiles are saved by name, their order may change
+			obs_data_array_t *names =
+				obs_data_get_array(item, "profiles");
+			size_t name_count = obs_data_array_count(names);
+			for (size_t n = 0; n < name_count; n++) {
+				obs_data_t *name = obs_data_array_item(names, n);
+				const char *value =
+					obs_data_get_string(name, "value");
+				for (size_t p = 0; p < discovery.profiles.size();
+				     p++) {
+					if (discovery.profiles[p].name == value)
+						source.profiles |= 1u << p;
+				}
+				obs_data_release(name);
+			}
+			obs_data_array_release(names);
+
+			if (source.profiles)
+				discovery.sources.emplace(ndi_name, source);
+		}
+		obs_data_release(item);
+	}
+	obs_data_array_release(array);
+	obs_data_release(data);
+
+	blog(LOG_INFO,
+	     "[obs-ndi] ndi_discovery_load_cache: %zu sources from the cache",
+	     discovery.sources.size());
+}
+
+static void ndi_discovery_save_cache()
+{
+	const uint64_t now = os_gettime_ns();
+	const int64_t wall_now = (int64_t)time(nullptr);
+
+	obs_data_array_t *array = obs_data_array_create();
+	for (auto &it : discovery.sources) {
+		const ndi_discovery_source_t *source = &it.second;
+		obs_data_t *item = obs_data_create();
+		obs_data_set_string(item, "name", source->ndi_name.constData());
+		obs_data_set_string(item, "url",
+				    source->url_address.constData());
+		obs_data_set_int(item, "last_seen",
+				 wall_now - (int64_t)((now - source->last_seen_ns) /
+						      1000000000ULL));
+
+		obs_data_array_t *names = obs_data_array_create();
+		for (size_t p = 0; p < discovery.profiles.size(); p++) {
+			if (!(source->profiles & (1u << p)))
+				continue;
+			obs_data_t *name = obs_data_create();
+			obs_data_set_string(name, "value",
+					    discovery.profiles[p].name.c_str());
+			obs_data_array_push_back(names, name);
+			obs_data_release(name);
+		}
+		obs_data_set_array(item, "profiles", names);
+		obs_data_array_release(names);
+
+		obs_data_array_push_back(array, item);
+		obs_data_release(item);
+	}
+
+	obs_data_t *data = obs_data_create();
+	obs_data_set_array(data, "sources", array);
+	obs_data_array_release(array);
+
+	char *dir = obs_module_config_path("");
+	os_mkdirs(dir);
+	bfree(dir);
+
+	char *path = obs_module_config_path(NDI_DISCOVERY_CACHE_FILE);
+	if (!obs_data_save_json_safe(data, path, "tmp", "bak")) {
+		blog(LOG_WARNING,
+		     "[obs-ndi] ndi_discovery_save_cache: Cannot write '%s'",
+		     path);
+	}
+	bfree(path);
+	obs_data_release(data);
+}
+
+void ndi_discovery_start()
+{
+	pthread_mutex_init(&discovery.mutex, nullptr);
+	discovery.signals = signal_handler_create();
+	signal_handler_add_array(discovery.signals, ndi_discovery_signals);
+
+	ndi_discovery_load_profiles();
+	ndi_discovery_load_cache();
+
+	for (auto &profile : discovery.profiles) {
+		NDIlib_find_create_t find_desc = {};
+		find_desc.show_local_sources = profile.show_local_sources;
+		find_desc.p_groups =
+			profile.groups.empty() ? nullptr : profile.groups.c_str();
+		find_desc.p_extra_ips = profile.extra_ips.empty()
+						? nullptr
+						: profile.extra_ips.c_str();
+		profile.ndi_finder = ndiLib->find_create_v2(&find_desc);
+		if (!profile.ndi_finder) {
+			blog(LOG_ERROR,
+			     "[obs-ndi] ndi_discovery_start: Cannot create NDI finder for profile '%s'",
+			     profile.name.c_str());
+			continue;
+		}
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_discovery_start: profile '%s' (groups='%s', extra_ips='%s', show_local_sources=%s)",
+		     profile.name.c_str(), profile.groups.c_str(),
+		     profile.extra_ips.c_str(),
+		     profile.show_local_sources ? "true" : "false");
+	}
+
+	discovery.running = true;
+	discovery.thread_started = pthread_create(&discovery.thread, nullptr,
+						  ndi_discovery_thread,
+						  nullptr) == 0;
+}
+
+void ndi_discovery_stop()
+{
+	discovery.running = false;
+	if (discovery.thread_started) {
+		pthread_join(discovery.thread, nullptr);
+		discovery.thread_started = false;
+	}
+
+	for (auto &profile : discovery.profiles) {
+		if (profile.ndi_finder)
+			ndiLib->find_destroy(profile.ndi_finder);
+	}
+
+	ndi_discovery_save_cache();
+	discovery.profiles.clear();
+	discovery.sources.clear();
+	signal_handler_destroy(discovery.signals);
+	discovery.signals = nullptr;
+	pthread_mutex_destroy(&discovery.mutex);
+}
+
+signal_handler_t *ndi_discovery_get_signal_handler()
+{
+	return discovery.signals;
+}
+
+void ndi_discovery_enum_profiles(ndi_discovery_enum_profiles_proc_t enum_proc,
+				 void *param)
+{
+	for (auto &profile : discovery.profiles) {
+		if (!enum_proc(param, profile.name.c_str()))
+			break;
+	}
+}
+
+static uint32_t ndi_discovery_profile_bit(const char *name)
+{
+	for (size_t p = 0; name && p < discovery.profiles.size(); p++) {
+		if (discovery.profiles[p].name == name)
+			return 1u << p;
+	}
+	return 1u;
+}
+
+void ndi_discovery_enum_sources(const char *profile,
+				ndi_discovery_enum_proc_t enum_proc,
+				void *param)
+{
+	const uint32_t bit = ndi_discovery_profile_bit(profile);
+
+	pthread_mutex_lock(&discovery.mutex);
+	for (auto &it : discovery.sources) {
+		if ((it.second.profiles & bit) && !enum_proc(param, &it.second))
+			break;
+	}
+	pthread_mutex_unlock(&discovery.mutex);
+}
+
+bool ndi_discovery_find_source(const char *ndi_name,
+			       ndi_discovery_source_t *source)
+{
+	pthread_mutex_lock(&discovery.mutex);
+	auto found = discovery.sources.find(ndi_name);
+	bool known = found != discovery.sources.end();
+	if (known)
+		*source = found->second;
+	pthread_mutex_unlock(&discovery.mutex);
+	return known;
+}
+
+size_t ndi_discovery_source_count()
+{
+	pthread_mutex_lock(&discovery.mutex);
+	size_t count = discovery.sources.size();
+	pthread_mutex_unlock(&discovery.mutex);
+	return count;
+}
@@ -0,0 +1,85 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <QByteArray>
+
+#include "plugin-main.h"
+
+// NDI sources on the network, found by a thread of its own and kept in an
+// index sorted by NDI name. Signals, on ndi_discovery_get_signal_handler():
+//   source_added(string ndi_name, string url_address)
+//   source_removed(string ndi_name)
+// They are emitted from the discovery thread.
+//
+// Searching is done per discovery profile (NDI groups, extra IPs or
+// discovery servers, local sources or not), each with its own NDI finder.
+// Profiles are read from discovery-profiles.json in the plugin config
+// directory:
+//   {"profiles": [{"name": "Studio B", "groups": "studio-b",
+//                  "extra_ips": "10.20.0.5", "show_local_sources": false}]}
+// The first profile is the default one. Without the file there is a
+// single default profile searching the local network in all groups.
+//
+// The index is saved to the plugin config directory on stop and loaded on
+// start, so that sources are listed and can be connected to before the
+// network has been searched. Cached sources that don't show up within a
+// few seconds of searching get removed.
+
+// Profiles past this many are ignored
+#define NDI_DISCOVERY_MAX_PROFILES 32
+
+typedef struct {
+	QByteArray ndi_name;
+	QByteArray url_address;
+	// os_gettime_ns() times
+	uint64_t first_seen_ns;
+	uint64_t last_seen_ns;
+	// False while only known from the cache
+	bool live;
+	// Bit i set when found by profile i
+	uint32_t profiles;
+} ndi_discovery_source_t;
+
+typedef bool (*ndi_discovery_enum_proc_t)(void *param,
+					  const ndi_discovery_source_t *source);
+typedef bool (*ndi_discovery_enum_profiles_proc_t)(void *param,
+						   const char *name);
+
+void ndi_discovery_start();
+void ndi_discovery_stop();
+
+signal_handler_t *ndi_discovery_get_signal_handler();
+
+// Profile names in configuration order, the default one first
+void ndi_discovery_enum_profiles(ndi_discovery_enum_profiles_proc_t enum_proc,
+				 void *param);
+
+// Sources found by the named profile (the default one for nullptr, "" or
+// an unknown name) in NDI name order, for as long as enum_proc returns
+// true. The index is locked meanwhile, so enum_proc must not call back in
+// here.
+void ndi_discovery_enum_sources(const char *profile,
+				ndi_discovery_enum_proc_t enum_proc,
+				void *param);
+// Copies the source called ndi_name to *source if any profile knows it
+bool ndi_discovery_find_source(const char *ndi_name,
+			       ndi_discovery_source_t *source);
+size_t ndi_discovery_source_count();
@@ -0,0 +1,337 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ndi-fields.h"
+#include "ndi-convert.h"
+
+#include <util/bmem.h>
+#include <string.h>
+#include <algorithm>
+
+// Lines of one plane of an NDI frame, planes follow each other in memory
+typedef struct {
+	size_t offset;
+	uint32_t lines;
+	uint32_t stride;
+	// 16-bit samples
+	bool wide;
+} frame_plane_t;
+
+#define MAX_FRAME_PLANES 3
+
+// Layout of frame's pixel format for a picture height lines high. Returns
+// the number of planes, 0 for formats the field stage doesn't know.
+static int frame_planes(const NDIlib_video_frame_v2_t *frame, uint32_t height,
+			frame_plane_t *planes)
+{
+	const uint32_t stride = frame->line_stride_in_bytes;
+	const uint32_t chroma_lines = (height + 1) / 2;
+	int count = 0;
+	size_t offset = 0;
+
+	auto add_plane = [&](uint32_t lines, uint32_t plane_stride,
+			     bool wide) {
+		planes[count].offset = offset;
+		planes[count].lines = lines;
+		planes[count].stride = plane_stride;
+		planes[count].wide = wide;
+		offset += (size_t)lines * plane_stride;
+		count++;
+	};
+
+	switch (frame->FourCC) {
+	case NDIlib_FourCC_type_UYVY:
+	case NDIlib_FourCC_type_BGRA:
+	case NDIlib_FourCC_type_BGRX:
+	case NDIlib_FourCC_type_RGBA:
+	case NDIlib_FourCC_type_RGBX:
+		add_plane(height, stride, false);
+		break;
+
+	case NDIlib_FourCC_type_UYVA:
+		add_plane(height, stride, false);
+		add_plane(height, frame->xres, false);
+		break;
+
+	case NDIlib_FourCC_type_P216:
+		add_plane(height, stride, true);
+		add_plane(height, stride, true);
+		break;
+
+	case NDIlib_FourCC_type_PA16:
+		add_plane(height, stride, true);
+		add_plane(height, stride, true);
+		add_plane(height, stride, true);
+		break;
+
+	case NDIlib_FourCC_type_NV12:
+		add_plane(height, stride, false);
+		add_plane(chroma_lines, stride, false);
+		break;
+
+	case NDIlib_FourCC_type_I420:
+	case NDIlib_FourCC_type_YV12:
+		add_plane(height, stride, false);
+		add_plane(chroma_lines, stride / 2, false);
+		add_plane(chroma_lines, stride / 2, false);
+		break;
+
+	default:
+		break;
+	}
+
+	return count;
+}
+
+static size_t frame_size(const frame_plane_t *planes, int count)
+{
+	const frame_plane_t *last = &planes[count - 1];
+	return last->offset + (size_t)last->lines * last->stride;
+}
+
+static uint8_t *ensure_buffer(uint8_t **buffer, size_t *buffer_size,
+			      size_t size)
+{
+	if (*buffer_size < size) {
+		bfree(*buffer);
+		*buffer = (uint8_t *)bmalloc(size);
+		*buffer_size = size;
+	}
+	return *buffer;
+}
+
+static void average_line(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+			 uint32_t bytes, bool wide)
+{
+	if (wide) {
+		ndi_convert_average_line_u16((const uint16_t *)a,
+					     (const uint16_t *)b,
+					     (uint16_t *)dst, bytes / 2);
+	} else {
+		ndi_convert_average_line_u8(a, b, dst, bytes);
+	}
+}
+
+// Fill every line of dst: the lines of the field's parity are copied, the
+// others interpolated from the field lines above and below.
+static void bob_plane(const uint8_t *field, uint32_t field_stride,
+		      uint32_t field_lines, uint8_t *dst,
+		      const frame_plane_t *dst_plane, uint32_t parity)
+{
+	if (!field_lines)
+		return;
+
+	const uint32_t last = field_lines - 1;
+	for (uint32_t y = 0; y < dst_plane->lines; y++) {
+		uint8_t *out = dst + (size_t)dst_plane->stride * y;
+		if ((y & 1) == parity) {
+			uint32_t line = std::min(y / 2, last);
+			memcpy(out, field + (size_t)field_stride * line,
+			       dst_plane->stride);
+			continue;
+		}
+
+		uint32_t below = std::min((y + 1) / 2, last);
+		uint32_t above = y ? std::min((y - 1) / 2, last) : below;
+		average_line(field + (size_t)field_stride * above,
+			     field + (size_t)field_stride * below, out,
+			     dst_plane->stride, dst_plane->wide);
+	}
+}
+
+// Copy the lines of a single field to the lines of its parity in dst
+static void weave_field(const NDIlib_video_frame_v2_t *field, uint8_t *dst,
+			const frame_plane_t *dst_planes, uint32_t parity)
+{
+	frame_plane_t planes[MAX_FRAME_PLANES];
+	const int count = frame_planes(field, field->yres, planes);
+
+	for (int p = 0; p < count; p++) {
+		const uint8_t *src = field->p_data + planes[p].offset;
+		uint8_t *out = dst + dst_planes[p].offset;
+		for (uint32_t y = 0; y < planes[p].lines; y++) {
+			uint32_t dst_line = y * 2 + parity;
+			if (dst_line >= dst_planes[p].lines)
+				break;
+			memcpy(out + (size_t)dst_planes[p].stride * dst_line,
+			       src + (size_t)planes[p].stride * y,
+			       dst_planes[p].stride);
+		}
+	}
+}
+
+// Line-double the field of the given parity out of src, which is either a
+// single field or a frame holding both fields on alternating lines.
+static void bob_field(ndi_fields_t *fields, const NDIlib_video_frame_v2_t *src,
+		      bool interleaved, uint32_t parity, int64_t time_offset,
+		      ndi_fields_output_t output, void *param)
+{
+	const uint32_t height = interleaved ? src->yres : src->yres * 2;
+
+	frame_plane_t src_planes[MAX_FRAME_PLANES];
+	frame_plane_t dst_planes[MAX_FRAME_PLANES];
+	const int count = frame_planes(src, src->yres, src_planes);
+	frame_planes(src, height, dst_planes);
+
+	uint8_t *dst = ensure_buffer(&fields->bob_buffer,
+				     &fields->bob_buffer_size,
+				     frame_size(dst_planes, count));
+
+	for (int p = 0; p < count; p++) {
+		const uint8_t *field = src->p_data + src_planes[p].offset;
+		uint32_t field_stride = src_planes[p].stride;
+		uint32_t field_lines = src_planes[p].lines;
+		if (interleaved) {
+			field += (size_t)field_stride * parity;
+			field_lines = (field_lines + 1 - parity) / 2;
+			field_stride *= 2;
+		}
+		bob_plane(field, field_stride, field_lines,
+			  dst + dst_planes[p].offset, &dst_planes[p], parity);
+	}
+
+	NDIlib_video_frame_v2_t frame = *src;
+	frame.yres = height;
+	frame.p_data = dst;
+	frame.frame_format_type = NDIlib_frame_format_type_progressive;
+	if (time_offset) {
+		if (frame.timestamp != NDIlib_recv_timestamp_undefined)
+			frame.timestamp += time_offset;
+		frame.timecode += time_offset;
+	}
+	output(param, &frame);
+}
+
+// Emit or drop the first field of a frame whose second field never came
+static void flush_pending(ndi_fields_t *fields,
+			  const ndi_fields_config_t *config,
+			  ndi_fields_output_t output, void *param)
+{
+	fields->has_pending = false;
+	if (config->fallback == NDI_FIELDS_FALLBACK_BOB) {
+		uint32_t parity = (config->order == NDI_FIELDS_TOP_FIRST) ? 0
+									  : 1;
+		bob_field(fields, &fields->pending, true, parity, 0, output,
+			  param);
+	}
+}
+
+static bool pending_matches(const ndi_fields_t *fields,
+			    const NDIlib_video_frame_v2_t *field)
+{
+	const NDIlib_video_frame_v2_t *pending = &fields->pending;
+	return pending->FourCC == field->FourCC &&
+	       pending->xres == field->xres &&
+	       pending->yres == field->yres * 2 &&
+	       pending->line_stride_in_bytes == field->line_stride_in_bytes;
+}
+
+void ndi_fields_process(ndi_fields_t *fields,
+			const ndi_fields_config_t *config,
+			NDIlib_video_frame_v2_t *frame,
+			ndi_fields_output_t output, void *param)
+{
+	frame_plane_t planes[MAX_FRAME_PLANES];
+	if (frame->frame_format_type == NDIlib_frame_format_type_progressive ||
+	    frame_planes(frame, frame->yres, planes) == 0) {
+		output(param, frame);
+		return;
+	}
+
+	const uint32_t first_parity =
+		(config->order == NDI_FIELDS_TOP_FIRST) ? 0 : 1;
+
+	if (frame->frame_format_type == NDIlib_frame_format_type_interleaved) {
+		if (config->mode == NDI_FIELDS_WEAVE) {
+			output(param, frame);
+			return;
+		}
+
+		// The second field is half a frame later than the first
+		int64_t half_frame = 0;
+		if (frame->frame_rate_N > 0) {
+			half_frame = (int64_t)frame->frame_rate_D * 10000000 /
+				     frame->frame_rate_N / 2;
+		}
+		bob_field(fields, frame, true, first_parity, 0, output, param);
+		bob_field(fields, frame, true, 1 - first_parity, half_frame,
+			  output, param);
+		return;
+	}
+
+	const uint32_t parity =
+		(frame->frame_format_type == NDIlib_frame_format_type_field_1)
+			? 1
+			: 0;
+
+	if (config->mode == NDI_FIELDS_BOB) {
+		bob_field(fields, frame, false, parity, 0, output, param);
+		return;
+	}
+
+	if (fields->has_pending &&
+	    (parity == first_parity || !pending_matches(fields, frame)))
+		flush_pending(fields, config, output, param);
+
+	if (parity != first_parity && !fields->has_pending) {
+		// Second field without a first one
+		if (config->fallback == NDI_FIELDS_FALLBACK_BOB)
+			bob_field(fields, frame, false, parity, 0, output,
+				  param);
+		return;
+	}
+
+	frame_plane_t dst_planes[MAX_FRAME_PLANES];
+	const int count = frame_planes(frame, frame->yres * 2, dst_planes);
+
+	if (parity == first_parity) {
+		uint8_t *dst = ensure_buffer(&fields->weave_buffer,
+					     &fields->weave_buffer_size,
+					     frame_size(dst_planes, count));
+		weave_field(frame, dst, dst_planes, parity);
+
+		// The frame takes the timing of its first field
+		fields->pending = *frame;
+		fields->pending.yres = frame->yres * 2;
+		fields->pending.p_data = dst;
+		fields->pending.p_metadata = nullptr;
+		fields->pending.frame_format_type =
+			NDIlib_frame_format_type_interleaved;
+		fields->has_pending = true;
+		return;
+	}
+
+	weave_field(frame, fields->weave_buffer, dst_planes, parity);
+	fields->has_pending = false;
+
+	NDIlib_video_frame_v2_t woven = fields->pending;
+	woven.frame_format_type = NDIlib_frame_format_type_progressive;
+	output(param, &woven);
+}
+
+void ndi_fields_reset(ndi_fields_t *fields)
+{
+	fields->has_pending = false;
+}
+
+void ndi_fields_free(ndi_fields_t *fields)
+{
+	bfree(fields->weave_buffer);
+	bfree(fields->bob_buffer);
+	*fields = {};
+}
@@ -0,0 +1,75 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <obs-module.h>
+
+#include "plugin-main.h"
+
+enum ndi_fields_mode {
+	// Pair two fields into one full frame
+	NDI_FIELDS_WEAVE,
+	// Line-double every field into a full frame, at field rate
+	NDI_FIELDS_BOB,
+};
+
+enum ndi_fields_order {
+	NDI_FIELDS_TOP_FIRST,
+	NDI_FIELDS_BOTTOM_FIRST,
+};
+
+enum ndi_fields_fallback {
+	// What to do in weave mode with a field that has no partner
+	NDI_FIELDS_FALLBACK_BOB,
+	NDI_FIELDS_FALLBACK_DROP,
+};
+
+typedef struct {
+	enum ndi_fields_mode mode;
+	enum ndi_fields_order order;
+	enum ndi_fields_fallback fallback;
+} ndi_fields_config_t;
+
+// Turns fielded NDI video into progressive frames. Not thread safe, meant
+// to be owned by the thread receiving the frames.
+typedef struct {
+	// Frame being woven, holds the first field until the second arrives
+	uint8_t *weave_buffer;
+	size_t weave_buffer_size;
+	NDIlib_video_frame_v2_t pending;
+	bool has_pending;
+
+	uint8_t *bob_buffer;
+	size_t bob_buffer_size;
+} ndi_fields_t;
+
+typedef void (*ndi_fields_output_t)(void *param,
+				    NDIlib_video_frame_v2_t *frame);
+
+// Calls output for every progressive frame that results from frame, which
+// may be none, one or two. Progressive frames and pixel formats that can't
+// be handled are passed straight through.
+void ndi_fields_process(ndi_fields_t *fields,
+			const ndi_fields_config_t *config,
+			NDIlib_video_frame_v2_t *frame,
+			ndi_fields_output_t output, void *param);
+
+// Forget a half woven frame
+void ndi_fields_reset(ndi_fields_t *fields);
+void ndi_fields_free(ndi_fields_t *fields);
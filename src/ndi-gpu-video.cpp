@@ -0,0 +1,429 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include <obs-module.h>
+#include <util/threading.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "ndi-gpu-video.h"
+#include "ndi-receiver.h"
+
+// Texture slots of the effect: luma or packed pixels, chroma, alpha
+#define NDI_GPU_VIDEO_PLANES 4
+
+static const char *plane_param_names[NDI_GPU_VIDEO_PLANES] = {
+	"image", "image1", "image2", "image3"};
+
+typedef struct {
+	const uint8_t *data;
+	uint32_t linesize;
+	uint32_t width;
+	uint32_t height;
+	gs_color_format format;
+} ndi_gpu_plane_t;
+
+// How a frame gets drawn
+typedef struct {
+	const char *technique;
+	// Picks the color matrix, VIDEO_FORMAT_NONE for RGB
+	video_format format;
+	// Unused slots have no data
+	ndi_gpu_plane_t planes[NDI_GPU_VIDEO_PLANES];
+} ndi_gpu_layout_t;
+
+// Frame waiting for the graphics thread, either still in NDI's buffer or
+// copied
+typedef struct {
+	ndi_video_ref_t *ref;
+	uint8_t *copy;
+	NDIlib_video_frame_v2_t frame;
+	video_colorspace colorspace;
+	video_range_type range;
+} ndi_gpu_frame_t;
+
+struct ndi_gpu_video {
+	gs_effect_t *effect;
+	gs_eparam_t *plane_params[NDI_GPU_VIDEO_PLANES];
+	gs_eparam_t *color_matrix_param;
+	gs_eparam_t *color_range_min_param;
+	gs_eparam_t *color_range_max_param;
+	gs_eparam_t *width_param;
+	gs_eparam_t *height_param;
+
+	// Protects the frame handed over to the graphics thread
+	pthread_mutex_t mutex;
+	ndi_gpu_frame_t pending;
+	bool has_pending;
+	bool clear;
+
+	// Size of the latest frame, reported before it gets drawn
+	std::atomic<uint32_t> width;
+	std::atomic<uint32_t> height;
+	std::atomic<int> unsupported_fourcc;
+
+	// Graphics thread only
+	gs_texture_t *textures[NDI_GPU_VIDEO_PLANES];
+	ndi_gpu_layout_t layout;
+	float color_matrix[16];
+	float color_range_min[3];
+	float color_range_max[3];
+	uint32_t picture_width;
+	uint32_t picture_height;
+	bool has_picture;
+};
+
+static void set_plane(ndi_gpu_plane_t *plane, const uint8_t *data,
+		      uint32_t linesize, uint32_t width, uint32_t height,
+		      gs_color_format format)
+{
+	plane->data = data;
+	plane->linesize = linesize;
+	plane->width = width;
+	plane->height = height;
+	plane->format = format;
+}
+
+// Returns false for formats the effect doesn't know
+static bool frame_layout(const NDIlib_video_frame_v2_t *frame,
+			 ndi_gpu_layout_t *layout)
+{
+	const uint32_t width = frame->xres;
+	const uint32_t height = frame->yres;
+	const uint32_t stride = frame->line_stride_in_bytes;
+	const uint32_t chroma_width = (width + 1) / 2;
+	const uint32_t chroma_height = (height + 1) / 2;
+	const uint8_t *src = frame->p_data;
+	ndi_gpu_plane_t *planes = layout->planes;
+
+	*layout = {};
+	layout->format = VIDEO_FORMAT_NONE;
+
+	switch (frame->FourCC) {
+	case NDIlib_FourCC_type_BGRA:
+		layout->technique = "Draw";
+		set_plane(&planes[0], src, stride, width, height, GS_BGRA);
+		return true;
+
+	case NDIlib_FourCC_type_BGRX:
+		layout->technique = "Draw";
+		set_plane(&planes[0], src, stride, width, height, GS_BGRX);
+		return true;
+
+	case NDIlib_FourCC_type_RGBA:
+	case NDIlib_FourCC_type_RGBX:
+		layout->technique = "Draw";
+		set_plane(&planes[0], src, stride, width, height, GS_RGBA);
+		return true;
+
+	case NDIlib_FourCC_type_UYVY:
+		layout->technique = "UYVY";
+		layout->format = VIDEO_FORMAT_UYVY;
+		set_plane(&planes[0], src, stride, chroma_width, height,
+			  GS_RGBA);
+		return true;
+
+	case NDIlib_FourCC_type_UYVA:
+		// The alpha plane follows the UYVY lines
+		layout->technique = "UYVA";
+		layout->format = VIDEO_FORMAT_UYVY;
+		set_plane(&planes[0], src, stride, chroma_width, height,
+			  GS_RGBA);
+		set_plane(&planes[3], src + (size_t)stride * height, width,
+			  width, height, GS_R8);
+		return true;
+
+	case NDIlib_FourCC_type_NV12:
+		layout->technique = "BiPlanar";
+		layout->format = VIDEO_FORMAT_NV12;
+		set_plane(&planes[0], src, stride, width, height, GS_R8);
+		set_plane(&planes[1], src + (size_t)stride * height, stride,
+			  chroma_width, chroma_height, GS_R8G8);
+		return true;
+
+	case NDIlib_FourCC_type_I420:
+	case NDIlib_FourCC_type_YV12: {
+		const uint8_t *first = src + (size_t)stride * height;
+		const uint8_t *second =
+			first + (size_t)(stride / 2) * chroma_height;
+		const bool yv12 = frame->FourCC == NDIlib_FourCC_type_YV12;
+		layout->technique = "Planar";
+		layout->format = VIDEO_FORMAT_I420;
+		set_plane(&planes[0], src, stride, width, height, GS_R8);
+		set_plane(&planes[1], yv12 ? second : first, stride / 2,
+			  chroma_width, chroma_height, GS_R8);
+		set_plane(&planes[2], yv12 ? first : second, stride / 2,
+			  chroma_width, chroma_height, GS_R8);
+		return true;
+	}
+
+	case NDIlib_FourCC_type_P216:
+	case NDIlib_FourCC_type_PA16:
+		// 16-bit samples, normalized like the most significant bits
+		// of P010
+		layout->format = VIDEO_FORMAT_P010;
+		set_plane(&planes[0], src, stride, width, height, GS_R16);
+		set_plane(&planes[1], src + (size_t)stride * height, stride,
+			  chroma_width, height, GS_RG16);
+		if (frame->FourCC == NDIlib_FourCC_type_PA16) {
+			layout->technique = "BiPlanarAlpha";
+			set_plane(&planes[3], src + (size_t)stride * height * 2,
+				  stride, width, height, GS_R16);
+		} else {
+			layout->technique = "BiPlanar";
+		}
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Bytes from the start of the frame to the end of its last plane
+static size_t frame_size(const NDIlib_video_frame_v2_t *frame,
+			 const ndi_gpu_layout_t *layout)
+{
+	size_t size = 0;
+	for (const ndi_gpu_plane_t &plane : layout->planes) {
+		if (!plane.data)
+			continue;
+		size_t end = (size_t)(plane.data - frame->p_data) +
+			     (size_t)plane.linesize * plane.height;
+		size = std::max(size, end);
+	}
+	return size;
+}
+
+static void ndi_gpu_frame_free(ndi_gpu_frame_t *frame)
+{
+	ndi_video_ref_release(frame->ref);
+	bfree(frame->copy);
+	*frame = {};
+}
+
+ndi_gpu_video_t *ndi_gpu_video_create()
+{
+	auto video = new ndi_gpu_video_t();
+	pthread_mutex_init(&video->mutex, nullptr);
+
+	char *file = obs_module_file("ndi-gpu-video.effect");
+	char *errors = nullptr;
+
+	obs_enter_graphics();
+	video->effect = gs_effect_create_from_file(file, &errors);
+	obs_leave_graphics();
+
+	if (!video->effect) {
+		blog(LOG_ERROR,
+		     "[obs-ndi] ndi_gpu_video_create: Cannot load '%s': %s",
+		     file ? file : "ndi-gpu-video.effect",
+		     errors ? errors : "(no error message)");
+	} else {
+		for (int i = 0; i < NDI_GPU_VIDEO_PLANES; i++) {
+			video->plane_params[i] = gs_effect_get_param_by_name(
+				video->effect, plane_param_names[i]);
+		}
+		video->color_matrix_param = gs_effect_get_param_by_name(
+			video->effect, "color_matrix");
+		video->color_range_min_param = gs_effect_get_param_by_name(
+			video->effect, "color_range_min");
+		video->color_range_max_param = gs_effect_get_param_by_name(
+			video->effect, "color_range_max");
+		video->width_param =
+			gs_effect_get_param_by_name(video->effect, "width");
+		video->height_param =
+			gs_effect_get_param_by_name(video->effect, "height");
+	}
+
+	bfree(errors);
+	bfree(file);
+	return video;
+}
+
+void ndi_gpu_video_destroy(ndi_gpu_video_t *video)
+{
+	if (!video)
+		return;
+
+	obs_enter_graphics();
+	for (gs_texture_t *texture : video->textures)
+		gs_texture_destroy(texture);
+	gs_effect_destroy(video->effect);
+	obs_leave_graphics();
+
+	if (video->has_pending)
+		ndi_gpu_frame_free(&video->pending);
+	pthread_mutex_destroy(&video->mutex);
+	delete video;
+}
+
+void ndi_gpu_video_submit(ndi_gpu_video_t *video,
+			  const NDIlib_video_frame_v2_t *frame,
+			  video_colorspace colorspace, video_range_type range)
+{
+	ndi_gpu_layout_t layout;
+	if (!frame_layout(frame, &layout)) {
+		if (video->unsupported_fourcc.exchange(frame->FourCC) !=
+		    (int)frame->FourCC)
+			blog(LOG_INFO,
+			     "[obs-ndi] warning: unsupported video pixel format: %d",
+			     frame->FourCC);
+		return;
+	}
+
+	ndi_gpu_frame_t next = {};
+	next.frame = *frame;
+	next.frame.p_metadata = nullptr;
+	next.colorspace = colorspace;
+	next.range = range;
+	next.ref = ndi_receiver_hold_video(frame);
+	if (!next.ref) {
+		size_t size = frame_size(frame, &layout);
+		next.copy = (uint8_t *)bmalloc(size);
+		memcpy(next.copy, frame->p_data, size);
+		next.frame.p_data = next.copy;
+	}
+
+	pthread_mutex_lock(&video->mutex);
+	ndi_gpu_frame_t replaced = video->pending;
+	bool had_pending = video->has_pending;
+	video->pending = next;
+	video->has_pending = true;
+	video->clear = false;
+	video->width = frame->xres;
+	video->height = frame->yres;
+	pthread_mutex_unlock(&video->mutex);
+
+	// Never drawn, a newer frame came first
+	if (had_pending)
+		ndi_gpu_frame_free(&replaced);
+}
+
+void ndi_gpu_video_clear(ndi_gpu_video_t *video)
+{
+	pthread_mutex_lock(&video->mutex);
+	ndi_gpu_frame_t replaced = video->pending;
+	bool had_pending = video->has_pending;
+	video->has_pending = false;
+	video->pending = {};
+	video->clear = true;
+	video->width = 0;
+	video->height = 0;
+	pthread_mutex_unlock(&video->mutex);
+
+	if (had_pending)
+		ndi_gpu_frame_free(&replaced);
+}
+
+uint32_t ndi_gpu_video_get_width(ndi_gpu_video_t *video)
+{
+	return video->width;
+}
+
+uint32_t ndi_gpu_video_get_height(ndi_gpu_video_t *video)
+{
+	return video->height;
+}
+
+// Textures are only recreated when the size or format of a plane changes
+static bool ndi_gpu_video_upload(ndi_gpu_video_t *video,
+				 const ndi_gpu_frame_t *frame)
+{
+	ndi_gpu_layout_t layout;
+	if (!frame_layout(&frame->frame, &layout))
+		return false;
+
+	for (int i = 0; i < NDI_GPU_VIDEO_PLANES; i++) {
+		const ndi_gpu_plane_t *plane = &layout.planes[i];
+		gs_texture_t *&texture = video->textures[i];
+		if (!plane->data)
+			continue;
+
+		if (texture &&
+		    (gs_texture_get_width(texture) != plane->width ||
+		     gs_texture_get_height(texture) != plane->height ||
+		     gs_texture_get_color_format(texture) != plane->format)) {
+			gs_texture_destroy(texture);
+			texture = nullptr;
+		}
+		if (!texture) {
+			texture = gs_texture_create(plane->width, plane->height,
+						    plane->format, 1, nullptr,
+						    GS_DYNAMIC);
+			if (!texture)
+				return false;
+		}
+		gs_texture_set_image(texture, plane->data, plane->linesize,
+				     false);
+	}
+
+	if (layout.format != VIDEO_FORMAT_NONE) {
+		video_format_get_parameters_for_format(
+			frame->colorspace, frame->range, layout.format,
+			video->color_matrix, video->color_range_min,
+			video->color_range_max);
+	}
+
+	video->layout = layout;
+	video->picture_width = frame->frame.xres;
+	video->picture_height = frame->frame.yres;
+	return true;
+}
+
+void ndi_gpu_video_render(ndi_gpu_video_t *video)
+{
+	pthread_mutex_lock(&video->mutex);
+	ndi_gpu_frame_t frame = video->pending;
+	bool has_frame = video->has_pending;
+	video->pending = {};
+	video->has_pending = false;
+	if (video->clear) {
+		video->clear = false;
+		video->has_picture = false;
+	}
+	pthread_mutex_unlock(&video->mutex);
+
+	if (has_frame) {
+		// The planes are on the GPU now, give the frame back to NDI
+		video->has_picture = video->effect &&
+				     ndi_gpu_video_upload(video, &frame);
+		ndi_gpu_frame_free(&frame);
+	}
+
+	if (!video->has_picture)
+		return;
+
+	for (int i = 0; i < NDI_GPU_VIDEO_PLANES; i++) {
+		if (video->layout.planes[i].data)
+			gs_effect_set_texture(video->plane_params[i],
+					      video->textures[i]);
+	}
+	gs_effect_set_val(video->color_matrix_param, video->color_matrix,
+			  sizeof(video->color_matrix));
+	gs_effect_set_val(video->color_range_min_param, video->color_range_min,
+			  sizeof(video->color_range_min));
+	gs_effect_set_val(video->color_range_max_param, video->color_range_max,
+			  sizeof(video->color_range_max));
+	gs_effect_set_float(video->width_param, (float)video->picture_width);
+	gs_effect_set_float(video->height_param, (float)video->picture_height);
+
+	while (gs_effect_loop(video->effect, video->layout.technique))
+		gs_draw_sprite(video->textures[0], 0, video->picture_width,
+			       video->picture_height);
+}
@@ -0,0 +1,48 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <obs-module.h>
+
+#include "plugin-main.h"
+
+// Draws the latest NDI video frame of a synchronous source. Frames are kept
+// in NDI's buffer until the graphics thread uploads their planes as they
+// are and converts them to RGB in a shader, instead of going through the
+// OBS async frame cache.
+typedef struct ndi_gpu_video ndi_gpu_video_t;
+
+// Both need the graphics context, they enter it themselves
+ndi_gpu_video_t *ndi_gpu_video_create();
+void ndi_gpu_video_destroy(ndi_gpu_video_t *video);
+
+// Called from the video callback with the frame to show next, replacing
+// any frame not drawn yet. Frames other than the one the receiver passed
+// to the callback (e.g. woven by the field stage) are copied.
+void ndi_gpu_video_submit(ndi_gpu_video_t *video,
+			  const NDIlib_video_frame_v2_t *frame,
+			  video_colorspace colorspace, video_range_type range);
+// Show nothing until the next frame
+void ndi_gpu_video_clear(ndi_gpu_video_t *video);
+
+uint32_t ndi_gpu_video_get_width(ndi_gpu_video_t *video);
+uint32_t ndi_gpu_video_get_height(ndi_gpu_video_t *video);
+
+// Graphics thread
+void ndi_gpu_video_render(ndi_gpu_video_t *video);
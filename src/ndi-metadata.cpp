@@ -0,0 +1,311 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ndi-metadata.h"
+
+// Frames a queue holds before dropping new ones. Power of two.
+#define NDI_METADATA_QUEUE_SIZE 64
+// Longest time the dispatcher sleeps without being woken up
+#define NDI_METADATA_DISPATCH_INTERVAL_MS 100
+
+static const char *ndi_metadata_signals[] = {
+	"void ndi_metadata(ptr source, string element, string data, int timecode)",
+	nullptr,
+};
+
+// Buffers are owned by the producer while the slot is free and by the
+// dispatcher while it is queued, and only ever grow
+typedef struct {
+	char *data;
+	size_t size;
+	size_t length;
+	int64_t timecode;
+} ndi_metadata_slot_t;
+
+typedef struct {
+	std::string data;
+	int64_t timecode;
+} ndi_metadata_last_t;
+
+struct ndi_metadata_queue {
+	obs_weak_source_t *source;
+
+	ndi_metadata_slot_t slots[NDI_METADATA_QUEUE_SIZE];
+	// Free running, head written by the dispatcher, tail by the producer
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	std::atomic<uint64_t> dropped;
+
+	pthread_mutex_t last_mutex;
+	std::map<std::string, ndi_metadata_last_t> last;
+};
+
+typedef struct {
+	ndi_metadata_queue_t *queue;
+	obs_weak_source_t *source;
+	std::string element;
+	std::string data;
+	int64_t timecode;
+} ndi_metadata_item_t;
+
+// Protects the queue list and the dispatcher's lifetime
+static pthread_mutex_t dispatcher_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<ndi_metadata_queue_t *> dispatcher_queues;
+static pthread_t dispatcher_thread;
+static bool dispatcher_started = false;
+static std::atomic<bool> dispatcher_running = false;
+static os_event_t *dispatcher_wake = nullptr;
+
+// Name of the root element, skipping an XML declaration and comments
+static std::string ndi_metadata_root_element(const char *data, size_t length)
+{
+	const char *p = data;
+	const char *end = data + length;
+
+	for (;;) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+				   *p == '\n'))
+			p++;
+		if (p + 1 >= end || *p != '<')
+			return std::string();
+
+		const char *close = nullptr;
+		if (p[1] == '?')
+			close = strstr(p, "?>");
+		else if (p[1] == '!')
+			close = strstr(p, ">");
+		else
+			break;
+		if (!close)
+			return std::string();
+		p = strchr(close, '>') + 1;
+	}
+
+	const char *name = ++p;
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' &&
+	       *p != '/' && *p != '>')
+		p++;
+	return std::string(name, p - name);
+}
+
+// Moves everything queued to batch. Called with dispatcher_mutex held.
+static void ndi_metadata_queue_drain(ndi_metadata_queue_t *queue,
+				     std::vector<ndi_metadata_item_t> &batch)
+{
+	uint32_t head = queue->head.load(std::memory_order_relaxed);
+	const uint32_t tail = queue->tail.load(std::memory_order_acquire);
+
+	for (; head != tail; head++) {
+		ndi_metadata_slot_t *slot =
+			&queue->slots[head & (NDI_METADATA_QUEUE_SIZE - 1)];
+
+		ndi_metadata_item_t item;
+		item.queue = queue;
+		item.source = queue->source;
+		item.data.assign(slot->data, slot->length);
+		item.element = ndi_metadata_root_element(item.data.c_str(),
+							 item.data.size());
+		item.timecode = slot->timecode;
+
+		// Hand the slot back before the (slow) consumers run
+		queue->head.store(head + 1, std::memory_order_release);
+
+		pthread_mutex_lock(&queue->last_mutex);
+		queue->last[item.element] = {item.data, item.timecode};
+		pthread_mutex_unlock(&queue->last_mutex);
+
+		obs_weak_source_addref(item.source);
+		batch.push_back(std::move(item));
+	}
+}
+
+static void ndi_metadata_emit(ndi_metadata_item_t *item)
+{
+	obs_source_t *source = obs_weak_source_get_source(item->source);
+	obs_weak_source_release(item->source);
+	if (!source)
+		return;
+
+	calldata_t cd;
+	calldata_init(&cd);
+	calldata_set_ptr(&cd, "source", source);
+	calldata_set_string(&cd, "element", item->element.c_str());
+	calldata_set_string(&cd, "data", item->data.c_str());
+	calldata_set_int(&cd, "timecode", item->timecode);
+	signal_handler_signal(obs_source_get_signal_handler(source),
+			      "ndi_metadata", &cd);
+	calldata_free(&cd);
+
+	obs_source_release(source);
+}
+
+static void *ndi_metadata_thread(void *)
+{
+	os_set_thread_name("ndi-metadata");
+	blog(LOG_INFO, "[obs-ndi] +ndi_metadata_thread()");
+
+	std::vector<ndi_metadata_item_t> batch;
+	while (dispatcher_running) {
+		os_event_timedwait(dispatcher_wake,
+				   NDI_METADATA_DISPATCH_INTERVAL_MS);
+
+		pthread_mutex_lock(&dispatcher_mutex);
+		for (auto queue : dispatcher_queues)
+			ndi_metadata_queue_drain(queue, batch);
+		pthread_mutex_unlock(&dispatcher_mutex);
+
+		// Consumers run without any lock, they may well touch sources
+		for (auto &item : batch)
+			ndi_metadata_emit(&item);
+		batch.clear();
+	}
+
+	blog(LOG_INFO, "[obs-ndi] -ndi_metadata_thread()");
+	return nullptr;
+}
+
+ndi_metadata_queue_t *ndi_metadata_queue_create(obs_source_t *source)
+{
+	auto queue = new ndi_metadata_queue_t();
+	queue->source = obs_source_get_weak_source(source);
+	pthread_mutex_init(&queue->last_mutex, nullptr);
+
+	signal_handler_add_array(obs_source_get_signal_handler(source),
+				 ndi_metadata_signals);
+
+	pthread_mutex_lock(&dispatcher_mutex);
+	dispatcher_queues.push_back(queue);
+	if (!dispatcher_started) {
+		os_event_init(&dispatcher_wake, OS_EVENT_TYPE_AUTO);
+		dispatcher_running = true;
+		dispatcher_started =
+			pthread_create(&dispatcher_thread, nullptr,
+				       ndi_metadata_thread, nullptr) == 0;
+	}
+	pthread_mutex_unlock(&dispatcher_mutex);
+
+	return queue;
+}
+
+void ndi_metadata_queue_destroy(ndi_metadata_queue_t *queue)
+{
+	if (!queue)
+		return;
+
+	// The dispatcher only touches queues it finds in the list
+	pthread_mutex_lock(&dispatcher_mutex);
+	auto &queues = dispatcher_queues;
+	queues.erase(std::remove(queues.begin(), queues.end(), queue),
+		     queues.end());
+	pthread_mutex_unlock(&dispatcher_mutex);
+
+	if (queue->dropped) {
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_metadata_queue_destroy: %llu metadata frames dropped",
+		     (unsigned long long)queue->dropped);
+	}
+
+	for (auto &slot : queue->slots)
+		bfree(slot.data);
+	obs_weak_source_release(queue->source);
+	pthread_mutex_destroy(&queue->last_mutex);
+	delete queue;
+}
+
+bool ndi_metadata_queue_push(ndi_metadata_queue_t *queue,
+			     const NDIlib_metadata_frame_t *frame)
+{
+	if (!frame->p_data)
+		return true;
+
+	const uint32_t tail = queue->tail.load(std::memory_order_relaxed);
+	const uint32_t head = queue->head.load(std::memory_order_acquire);
+	if (tail - head == NDI_METADATA_QUEUE_SIZE) {
+		queue->dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	ndi_metadata_slot_t *slot =
+		&queue->slots[tail & (NDI_METADATA_QUEUE_SIZE - 1)];
+	size_t length = frame->length > 0 ? (size_t)frame->length - 1
+					  : strlen(frame->p_data);
+	if (slot->size < length) {
+		bfree(slot->data);
+		slot->data = (char *)bmalloc(length);
+		slot->size = length;
+	}
+	memcpy(slot->data, frame->p_data, length);
+	slot->length = length;
+	slot->timecode = frame->timecode;
+
+	queue->tail.store(tail + 1, std::memory_order_release);
+
+	// Every time: a dispatcher that drained up to an older tail may be
+	// about to sleep, and would otherwise only see this frame on its
+	// next timeout
+	os_event_signal(dispatcher_wake);
+	return true;
+}
+
+uint64_t ndi_metadata_queue_dropped(ndi_metadata_queue_t *queue)
+{
+	return queue->dropped.load(std::memory_order_relaxed);
+}
+
+bool ndi_metadata_queue_get_last(ndi_metadata_queue_t *queue,
+				 const char *element, QByteArray *data,
+				 int64_t *timecode)
+{
+	pthread_mutex_lock(&queue->last_mutex);
+	auto found = queue->last.find(element);
+	bool known = found != queue->last.end();
+	if (known) {
+		*data = QByteArray(found->second.data.c_str(),
+				   (int)found->second.data.size());
+		*timecode = found->second.timecode;
+	}
+	pthread_mutex_unlock(&queue->last_mutex);
+	return known;
+}
+
+void ndi_metadata_shutdown()
+{
+	pthread_mutex_lock(&dispatcher_mutex);
+	bool started = dispatcher_started;
+	dispatcher_started = false;
+	dispatcher_running = false;
+	pthread_mutex_unlock(&dispatcher_mutex);
+
+	if (!started)
+		return;
+
+	os_event_signal(dispatcher_wake);
+	pthread_join(dispatcher_thread, nullptr);
+	os_event_destroy(dispatcher_wake);
+	dispatcher_wake = nullptr;
+}
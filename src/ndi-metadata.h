@@ -0,0 +1,52 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <QByteArray>
+
+#include "plugin-main.h"
+
+// Metadata frames received for an OBS source. Receivers push them into the
+// source's queue without ever blocking. A dispatcher thread shared by all
+// sources picks them up in batches, parses the name of their root XML
+// element and emits them on the source as
+//   ndi_metadata(ptr source, string element, string data, int timecode)
+// The latest frame of every element is also kept for
+// ndi_metadata_queue_get_last().
+
+typedef struct ndi_metadata_queue ndi_metadata_queue_t;
+
+ndi_metadata_queue_t *ndi_metadata_queue_create(obs_source_t *source);
+// No push may be in progress or follow
+void ndi_metadata_queue_destroy(ndi_metadata_queue_t *queue);
+
+// Single producer at a time. Returns false and counts the frame as dropped
+// when the queue is full.
+bool ndi_metadata_queue_push(ndi_metadata_queue_t *queue,
+			     const NDIlib_metadata_frame_t *frame);
+uint64_t ndi_metadata_queue_dropped(ndi_metadata_queue_t *queue);
+
+// Copies the latest frame with the given root element to *data
+bool ndi_metadata_queue_get_last(ndi_metadata_queue_t *queue,
+				 const char *element, QByteArray *data,
+				 int64_t *timecode);
+
+// Stops the dispatcher, all queues must be destroyed already
+void ndi_metadata_shutdown();
@@ -0,0 +1,691 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <QString>
+
+#include "plugin-main.h"
+#include "ndi-convert.h"
+#include "ndi-receiver.h"
+#include "ndi-worker-pool.h"
+
+// Many NDI sources composited into one grid on the CPU and output as a
+// single async frame, e.g. for a multiview of all cameras. Feeds are
+// received at the lowest bandwidth in BGRX/BGRA, scaled to their cell on
+// the receiver tasks as they arrive, and blitted into the grid by a task
+// of its own at the configured frame rate.
+
+#define PROP_MV_SOURCES "ndi_multiviewer_sources"
+#define PROP_MV_COLUMNS "ndi_multiviewer_columns"
+#define PROP_MV_WIDTH "ndi_multiviewer_width"
+#define PROP_MV_HEIGHT "ndi_multiviewer_height"
+#define PROP_MV_FPS "ndi_multiviewer_fps"
+
+#define NDI_MULTIVIEWER_MAX_TILES 64
+// Black between cells, in pixels
+#define NDI_MULTIVIEWER_SPACING 4
+// A cell goes black when its feed stops for this long
+#define NDI_MULTIVIEWER_STALE_NS 3000000000ULL
+
+typedef struct ndi_multiviewer ndi_multiviewer_t;
+
+typedef struct {
+	QByteArray ndi_name;
+	QByteArray ndi_receiver_name;
+	ndi_receiver_t *receiver;
+
+	// Receiver task only: box filtered frames and the scaled image
+	// being put together
+	uint8_t *reduced[2];
+	size_t reduced_size[2];
+	uint8_t *back;
+	size_t back_size;
+
+	pthread_mutex_t mutex;
+	// Cell area inside the grid, moved under mutex when the layout
+	// changes
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	// Latest scaled image, swapped with back under mutex
+	uint8_t *front;
+	size_t front_size;
+	uint32_t image_width;
+	uint32_t image_height;
+	uint64_t image_ns;
+
+	// Output task only: image rectangle drawn last time, to know when
+	// the cell needs clearing
+	uint32_t drawn_width;
+	uint32_t drawn_height;
+} ndi_multiviewer_tile_t;
+
+struct ndi_multiviewer {
+	obs_source_t *obs_source;
+
+	// Serializes update, show, hide and destroy
+	pthread_mutex_t state_mutex;
+	QList<QByteArray> ndi_names;
+	uint32_t columns;
+	uint32_t width;
+	uint32_t height;
+	uint32_t fps;
+	bool showing;
+	// ndi_multiviewer_retire
+	int retiring;
+	pthread_cond_t retired;
+
+	// Tiles the output task draws, swapped as a whole under tiles_mutex
+	pthread_mutex_t tiles_mutex;
+	std::vector<ndi_multiviewer_tile_t *> tiles;
+	uint8_t *canvas;
+	size_t canvas_size;
+	uint32_t canvas_width;
+	uint32_t canvas_height;
+	bool canvas_clear;
+	uint64_t frame_interval_ns;
+
+	ndi_task_t *task;
+	std::atomic<bool> running;
+	uint64_t next_frame_ns;
+	obs_source_frame frame;
+};
+
+static uint8_t *ensure_buffer(uint8_t **buffer, size_t *buffer_size,
+			      size_t size)
+{
+	if (*buffer_size < size) {
+		bfree(*buffer);
+		*buffer = (uint8_t *)bmalloc(size);
+		*buffer_size = size;
+	}
+	return *buffer;
+}
+
+//
+// Receiver side
+//
+
+static bool ndi_multiviewer_tile_sync_config(void *)
+{
+	return false;
+}
+
+static void ndi_multiviewer_tile_get_control(void *data,
+					     ndi_receiver_control_t *control)
+{
+	auto tile = (ndi_multiviewer_tile_t *)data;
+	// Multiviewers don't show up on tally or move cameras
+	if (control->ndi_receiver_name.isEmpty())
+		control->ndi_receiver_name = tile->ndi_receiver_name;
+}
+
+// Largest size with the frame's aspect ratio that fits a cell of
+// cell_width x cell_height, both at least 1
+static void ndi_multiviewer_fit(uint32_t cell_width, uint32_t cell_height,
+				const NDIlib_video_frame_v2_t *frame,
+				uint32_t *width, uint32_t *height)
+{
+	double aspect = frame->picture_aspect_ratio;
+	if (aspect <= 0.0f) {
+		// Single fields are half as high as the picture
+		bool field = frame->frame_format_type ==
+				     NDIlib_frame_format_type_field_0 ||
+			     frame->frame_format_type ==
+				     NDIlib_frame_format_type_field_1;
+		aspect = (double)frame->xres / (frame->yres * (field ? 2 : 1));
+	}
+
+	if (aspect * cell_height > cell_width) {
+		*width = cell_width;
+		*height = (uint32_t)lround(cell_width / aspect);
+	} else {
+		*width = (uint32_t)lround(cell_height * aspect);
+		*height = cell_height;
+	}
+	*width = std::clamp(*width, 1u, cell_width);
+	*height = std::clamp(*height, 1u, cell_height);
+}
+
+static void ndi_multiviewer_tile_video(void *data,
+				       NDIlib_video_frame_v2_t *frame,
+				       uint64_t)
+{
+	auto tile = (ndi_multiviewer_tile_t *)data;
+	if (frame->FourCC != NDIlib_FourCC_type_BGRA &&
+	    frame->FourCC != NDIlib_FourCC_type_BGRX)
+		return;
+	if (frame->xres <= 0 || frame->yres <= 0)
+		return;
+
+	// The output task skips the image if the layout changes meanwhile
+	pthread_mutex_lock(&tile->mutex);
+	const uint32_t cell_width = tile->width;
+	const uint32_t cell_height = tile->height;
+	pthread_mutex_unlock(&tile->mutex);
+	if (!cell_width || !cell_height)
+		return;
+
+	uint32_t width, height;
+	ndi_multiviewer_fit(cell_width, cell_height, frame, &width, &height);
+
+	const uint8_t *src = frame->p_data;
+	uint32_t src_width = (uint32_t)frame->xres;
+	uint32_t src_height = (uint32_t)frame->yres;
+	uint32_t src_stride = (uint32_t)frame->line_stride_in_bytes;
+
+	// Box filter senders that ignore the lowest bandwidth down to less
+	// than twice the cell size, bilinear alone would alias
+	for (int pass = 0;
+	     src_width >= width * 2 && src_height >= height * 2; pass++) {
+		const uint32_t half_width = src_width / 2;
+		const uint32_t half_height = src_height / 2;
+		uint8_t *half = ensure_buffer(&tile->reduced[pass & 1],
+					      &tile->reduced_size[pass & 1],
+					      (size_t)half_width * half_height *
+						      4);
+		for (uint32_t y = 0; y < half_height; y++) {
+			const uint8_t *a = src + (size_t)src_stride * y * 2;
+			ndi_convert_halve_line_u32(
+				a, a + src_stride,
+				half + (size_t)half_width * 4 * y, half_width);
+		}
+		src = half;
+		src_width = half_width;
+		src_height = half_height;
+		src_stride = half_width * 4;
+	}
+
+	uint8_t *image = ensure_buffer(&tile->back, &tile->back_size,
+				       (size_t)width * height * 4);
+	ndi_convert_scale_u32(src, src_stride, src_width, src_height, image,
+			      width * 4, width, height);
+
+	pthread_mutex_lock(&tile->mutex);
+	std::swap(tile->front, tile->back);
+	std::swap(tile->front_size, tile->back_size);
+	tile->image_width = width;
+	tile->image_height = height;
+	tile->image_ns = os_gettime_ns();
+	pthread_mutex_unlock(&tile->mutex);
+}
+
+static void ndi_multiviewer_tile_audio(void *, NDIlib_audio_frame_v3_t *) {}
+
+static void ndi_multiviewer_tile_metadata(void *, NDIlib_metadata_frame_t *)
+{
+}
+
+static void ndi_multiviewer_tile_stats(void *, const ndi_receiver_stats_t *)
+{
+}
+
+static const ndi_receiver_callbacks_t ndi_multiviewer_tile_callbacks = {
+	ndi_multiviewer_tile_sync_config, ndi_multiviewer_tile_get_control,
+	ndi_multiviewer_tile_video,	  ndi_multiviewer_tile_audio,
+	ndi_multiviewer_tile_metadata,	  ndi_multiviewer_tile_stats,
+};
+
+// Called with tile->mutex held, or before the tile is subscribed
+static void ndi_multiviewer_tile_place(ndi_multiviewer_tile_t *tile,
+				       uint32_t x, uint32_t y, uint32_t width,
+				       uint32_t height)
+{
+	tile->x = x;
+	tile->y = y;
+	tile->width = width;
+	tile->height = height;
+	// Redrawn from black in the new cell
+	tile->drawn_width = 0;
+	tile->drawn_height = 0;
+}
+
+static void ndi_multiviewer_tile_destroy(ndi_multiviewer_tile_t *tile)
+{
+	// No more callbacks after this
+	ndi_receiver_unsubscribe(tile->receiver, tile);
+
+	pthread_mutex_destroy(&tile->mutex);
+	bfree(tile->reduced[0]);
+	bfree(tile->reduced[1]);
+	bfree(tile->back);
+	bfree(tile->front);
+	delete tile;
+}
+
+//
+// Grid
+//
+
+static void ndi_multiviewer_fill_black(uint8_t *canvas, uint32_t stride,
+				       uint32_t x, uint32_t y, uint32_t width,
+				       uint32_t height)
+{
+	for (uint32_t line = 0; line < height; line++)
+		memset(canvas + (size_t)stride * (y + line) + (size_t)x * 4, 0,
+		       (size_t)width * 4);
+}
+
+// Output task, once per output frame
+static uint64_t ndi_multiviewer_task(void *data)
+{
+	auto mv = (ndi_multiviewer_t *)data;
+	if (!mv->running)
+		return NDI_TASK_DONE;
+
+	const uint64_t now = os_gettime_ns();
+
+	pthread_mutex_lock(&mv->tiles_mutex);
+	const uint32_t stride = mv->canvas_width * 4;
+	if (mv->canvas_clear) {
+		memset(mv->canvas, 0, (size_t)stride * mv->canvas_height);
+		mv->canvas_clear = false;
+	}
+
+	for (ndi_multiviewer_tile_t *tile : mv->tiles) {
+		pthread_mutex_lock(&tile->mutex);
+		uint32_t width = tile->image_width;
+		uint32_t height = tile->image_height;
+		if (!tile->front ||
+		    now - tile->image_ns > NDI_MULTIVIEWER_STALE_NS ||
+		    width > tile->width || height > tile->height)
+			// Stale, or scaled for the cell before a layout change
+			width = height = 0;
+
+		if (width != tile->drawn_width ||
+		    height != tile->drawn_height) {
+			// Letterbox bars of the previous image stay otherwise
+			ndi_multiviewer_fill_black(mv->canvas, stride, tile->x,
+						   tile->y, tile->width,
+						   tile->height);
+			tile->drawn_width = width;
+			tile->drawn_height = height;
+		}
+
+		// Centered in the cell
+		const uint32_t x = tile->x + (tile->width - width) / 2;
+		const uint32_t y = tile->y + (tile->height - height) / 2;
+		for (uint32_t line = 0; line < height; line++)
+			memcpy(mv->canvas + (size_t)stride * (y + line) +
+				       (size_t)x * 4,
+			       tile->front + (size_t)width * 4 * line,
+			       (size_t)width * 4);
+		pthread_mutex_unlock(&tile->mutex);
+	}
+
+	mv->frame.data[0] = mv->canvas;
+	mv->frame.linesize[0] = stride;
+	mv->frame.width = mv->canvas_width;
+	mv->frame.height = mv->canvas_height;
+	mv->frame.timestamp = now;
+	// Copied into the async frame cache, the canvas is ours again after
+	obs_source_output_video(mv->obs_source, &mv->frame);
+	const uint64_t interval = mv->frame_interval_ns;
+	pthread_mutex_unlock(&mv->tiles_mutex);
+
+	mv->next_frame_ns += interval;
+	if (mv->next_frame_ns + interval < now)
+		// Fell behind, don't try to catch up
+		mv->next_frame_ns = now + interval;
+	return mv->next_frame_ns;
+}
+
+typedef struct {
+	ndi_multiviewer_t *mv;
+	std::vector<ndi_multiviewer_tile_t *> tiles;
+} ndi_multiviewer_retired_t;
+
+static void *ndi_multiviewer_retire_thread(void *data)
+{
+	auto retired = (ndi_multiviewer_retired_t *)data;
+	auto mv = retired->mv;
+
+	os_set_thread_name("ndi-retire");
+	for (ndi_multiviewer_tile_t *tile : retired->tiles)
+		ndi_multiviewer_tile_destroy(tile);
+	delete retired;
+
+	pthread_mutex_lock(&mv->state_mutex);
+	mv->retiring--;
+	pthread_cond_signal(&mv->retired);
+	pthread_mutex_unlock(&mv->state_mutex);
+	return nullptr;
+}
+
+// Destroy tiles the output task no longer draws on a thread of their own.
+// Destroying NDI receivers can take a while and this is called from the
+// graphics and UI threads. Called with state_mutex held.
+static void ndi_multiviewer_retire(ndi_multiviewer_t *mv,
+				   std::vector<ndi_multiviewer_tile_t *> &tiles)
+{
+	if (tiles.empty())
+		return;
+
+	auto retired = new ndi_multiviewer_retired_t();
+	retired->mv = mv;
+	retired->tiles.swap(tiles);
+
+	pthread_t thread;
+	if (pthread_create(&thread, nullptr, ndi_multiviewer_retire_thread,
+			   retired) != 0) {
+		for (ndi_multiviewer_tile_t *tile : retired->tiles)
+			ndi_multiviewer_tile_destroy(tile);
+		delete retired;
+		return;
+	}
+	pthread_detach(thread);
+	mv->retiring++;
+}
+
+// Put every NDI source in its own cell for the current settings. Tiles of
+// sources already shown are kept as they are and only moved, new ones are
+// subscribed before the tiles of sources gone from the list let go of
+// their receivers, so a feed in both lists stays connected throughout.
+// Called with state_mutex held.
+static void ndi_multiviewer_layout(ndi_multiviewer_t *mv)
+{
+	const uint32_t count = std::min((uint32_t)mv->ndi_names.size(),
+					(uint32_t)NDI_MULTIVIEWER_MAX_TILES);
+	uint32_t columns = mv->columns;
+	if (!columns)
+		columns = (uint32_t)ceil(sqrt((double)count));
+	columns = std::max(columns, 1u);
+	const uint32_t rows = std::max((count + columns - 1) / columns, 1u);
+
+	const uint32_t cell_width = mv->width / columns;
+	const uint32_t cell_height = mv->height / rows;
+	const uint32_t spacing =
+		std::min<uint32_t>(NDI_MULTIVIEWER_SPACING,
+				   std::min(cell_width, cell_height) / 4);
+
+	const QByteArray receiver_name =
+		QString("OBS-NDI Multiviewer '%1'")
+			.arg(obs_source_get_name(mv->obs_source))
+			.toUtf8();
+
+	ndi_receiver_key_t key = {};
+	key.bandwidth = NDIlib_recv_bandwidth_lowest;
+	key.color_format = NDIlib_recv_color_format_BGRX_BGRA;
+	key.framesync_enabled = false;
+	key.framesync_pacing = false;
+	// Only the latest frame of each feed matters
+	key.newest_video_only = true;
+
+	// Only changed with state_mutex held, which we have
+	std::vector<ndi_multiviewer_tile_t *> old_tiles = mv->tiles;
+	std::vector<ndi_multiviewer_tile_t *> tiles;
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const QByteArray &ndi_name = mv->ndi_names.at((int)i);
+		auto it = std::find_if(old_tiles.begin(), old_tiles.end(),
+				       [&](ndi_multiviewer_tile_t *tile) {
+					       return tile->ndi_name ==
+							      ndi_name &&
+						      tile->ndi_receiver_name ==
+							      receiver_name;
+				       });
+		if (it != old_tiles.end()) {
+			// Moved to its new cell below, with the rest
+			tiles.push_back(*it);
+			old_tiles.erase(it);
+			kept++;
+			continue;
+		}
+
+		auto tile = new ndi_multiviewer_tile_t();
+		tile->ndi_name = ndi_name;
+		tile->ndi_receiver_name = receiver_name;
+		pthread_mutex_init(&tile->mutex, nullptr);
+		ndi_multiviewer_tile_place(
+			tile, (i % columns) * cell_width + spacing / 2,
+			(i / columns) * cell_height + spacing / 2,
+			cell_width - spacing, cell_height - spacing);
+
+		key.ndi_source_name = tile->ndi_name;
+		tile->receiver = ndi_receiver_subscribe(
+			&key, &ndi_multiviewer_tile_callbacks, tile);
+		tiles.push_back(tile);
+	}
+
+	pthread_mutex_lock(&mv->tiles_mutex);
+	for (uint32_t i = 0; i < count; i++) {
+		ndi_multiviewer_tile_t *tile = tiles[i];
+		pthread_mutex_lock(&tile->mutex);
+		ndi_multiviewer_tile_place(
+			tile, (i % columns) * cell_width + spacing / 2,
+			(i / columns) * cell_height + spacing / 2,
+			cell_width - spacing, cell_height - spacing);
+		pthread_mutex_unlock(&tile->mutex);
+	}
+	mv->tiles.swap(tiles);
+	mv->canvas_width = mv->width;
+	mv->canvas_height = mv->height;
+	ensure_buffer(&mv->canvas, &mv->canvas_size,
+		      (size_t)mv->width * mv->height * 4);
+	mv->canvas_clear = true;
+	mv->frame_interval_ns = 1000000000ULL / mv->fps;
+	pthread_mutex_unlock(&mv->tiles_mutex);
+
+	ndi_multiviewer_retire(mv, old_tiles);
+
+	blog(LOG_INFO,
+	     "[obs-ndi] ndi_multiviewer_layout: '%s' %u sources (%u kept) in %ux%u cells of %ux%u at %u fps",
+	     obs_source_get_name(mv->obs_source), count, kept, columns, rows,
+	     cell_width, cell_height, mv->fps);
+}
+
+// Called with state_mutex held
+static void ndi_multiviewer_start(ndi_multiviewer_t *mv)
+{
+	ndi_multiviewer_layout(mv);
+
+	mv->running = true;
+	mv->next_frame_ns = os_gettime_ns();
+	mv->task = ndi_task_start(ndi_multiviewer_task, mv);
+}
+
+// Called with state_mutex held
+static void ndi_multiviewer_stop(ndi_multiviewer_t *mv)
+{
+	if (mv->task) {
+		mv->running = false;
+		ndi_task_wake(mv->task);
+		ndi_task_join(mv->task);
+		mv->task = nullptr;
+	}
+
+	std::vector<ndi_multiviewer_tile_t *> tiles;
+	pthread_mutex_lock(&mv->tiles_mutex);
+	mv->tiles.swap(tiles);
+	pthread_mutex_unlock(&mv->tiles_mutex);
+
+	ndi_multiviewer_retire(mv, tiles);
+}
+
+//
+// OBS source
+//
+
+static const char *ndi_multiviewer_getname(void *)
+{
+	return obs_module_text("NDIPlugin.NDIMultiviewerName");
+}
+
+static obs_properties_t *ndi_multiviewer_getproperties(void *)
+{
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_editable_list(
+		props, PROP_MV_SOURCES,
+		obs_module_text("NDIPlugin.MultiviewerProps.Sources"),
+		OBS_EDITABLE_LIST_TYPE_STRINGS, nullptr, nullptr);
+	obs_properties_add_int(
+		props, PROP_MV_COLUMNS,
+		obs_module_text("NDIPlugin.MultiviewerProps.Columns"), 0, 16, 1);
+	obs_properties_add_int(props, PROP_MV_WIDTH,
+			       obs_module_text("NDIPlugin.MultiviewerProps.Width"),
+			       320, 7680, 2);
+	obs_properties_add_int(
+		props, PROP_MV_HEIGHT,
+		obs_module_text("NDIPlugin.MultiviewerProps.Height"), 180, 4320,
+		2);
+	obs_property_t *fps = obs_properties_add_int(
+		props, PROP_MV_FPS,
+		obs_module_text("NDIPlugin.MultiviewerProps.FrameRate"), 1, 60,
+		1);
+	obs_property_int_set_suffix(fps, " fps");
+
+	return props;
+}
+
+static void ndi_multiviewer_getdefaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, PROP_MV_COLUMNS, 0);
+	obs_data_set_default_int(settings, PROP_MV_WIDTH, 1920);
+	obs_data_set_default_int(settings, PROP_MV_HEIGHT, 1080);
+	obs_data_set_default_int(settings, PROP_MV_FPS, 30);
+}
+
+static void ndi_multiviewer_update(void *data, obs_data_t *settings)
+{
+	auto mv = (ndi_multiviewer_t *)data;
+
+	pthread_mutex_lock(&mv->state_mutex);
+	mv->ndi_names.clear();
+	obs_data_array_t *sources =
+		obs_data_get_array(settings, PROP_MV_SOURCES);
+	size_t count = obs_data_array_count(sources);
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *item = obs_data_array_item(sources, i);
+		const char *ndi_name = obs_data_get_string(item, "value");
+		if (*ndi_name)
+			mv->ndi_names.append(ndi_name);
+		obs_data_release(item);
+	}
+	obs_data_array_release(sources);
+
+	// Within the ranges of the properties, settings written by hand or
+	// by scripts included. Even sizes, for the sake of the video
+	// encoders downstream.
+	mv->columns = (uint32_t)std::clamp<long long>(
+		obs_data_get_int(settings, PROP_MV_COLUMNS), 0, 16);
+	mv->width = (uint32_t)std::clamp<long long>(
+			    obs_data_get_int(settings, PROP_MV_WIDTH), 320,
+			    7680) &
+		    ~1u;
+	mv->height = (uint32_t)std::clamp<long long>(
+			     obs_data_get_int(settings, PROP_MV_HEIGHT), 180,
+			     4320) &
+		     ~1u;
+	mv->fps = (uint32_t)std::clamp<long long>(
+		obs_data_get_int(settings, PROP_MV_FPS), 1, 60);
+
+	if (mv->showing)
+		ndi_multiviewer_layout(mv);
+	pthread_mutex_unlock(&mv->state_mutex);
+}
+
+static void ndi_multiviewer_shown(void *data)
+{
+	auto mv = (ndi_multiviewer_t *)data;
+	pthread_mutex_lock(&mv->state_mutex);
+	if (!mv->showing) {
+		mv->showing = true;
+		ndi_multiviewer_start(mv);
+	}
+	pthread_mutex_unlock(&mv->state_mutex);
+}
+
+static void ndi_multiviewer_hidden(void *data)
+{
+	auto mv = (ndi_multiviewer_t *)data;
+	pthread_mutex_lock(&mv->state_mutex);
+	if (mv->showing) {
+		mv->showing = false;
+		ndi_multiviewer_stop(mv);
+	}
+	pthread_mutex_unlock(&mv->state_mutex);
+}
+
+static void *ndi_multiviewer_create(obs_data_t *settings, obs_source_t *source)
+{
+	auto mv = new ndi_multiviewer_t();
+	mv->obs_source = source;
+	pthread_mutex_init(&mv->state_mutex, nullptr);
+	pthread_cond_init(&mv->retired, nullptr);
+	pthread_mutex_init(&mv->tiles_mutex, nullptr);
+
+	mv->frame.format = VIDEO_FORMAT_BGRX;
+	mv->frame.full_range = true;
+
+	blog(LOG_INFO, "[obs-ndi] ndi_multiviewer_create('%s'...)",
+	     obs_source_get_name(source));
+	ndi_multiviewer_update(mv, settings);
+	return mv;
+}
+
+static void ndi_multiviewer_destroy(void *data)
+{
+	auto mv = (ndi_multiviewer_t *)data;
+	blog(LOG_INFO, "[obs-ndi] ndi_multiviewer_destroy('%s'...)",
+	     obs_source_get_name(mv->obs_source));
+
+	pthread_mutex_lock(&mv->state_mutex);
+	ndi_multiviewer_stop(mv);
+	// Receivers gone from the worker pool before the plugin unloads
+	while (mv->retiring > 0)
+		pthread_cond_wait(&mv->retired, &mv->state_mutex);
+	pthread_mutex_unlock(&mv->state_mutex);
+
+	bfree(mv->canvas);
+	pthread_mutex_destroy(&mv->tiles_mutex);
+	pthread_cond_destroy(&mv->retired);
+	pthread_mutex_destroy(&mv->state_mutex);
+	delete mv;
+}
+
+obs_source_info create_ndi_multiviewer_info()
+{
+	obs_source_info ndi_multiviewer_info = {};
+	ndi_multiviewer_info.id = "ndi_multiviewer";
+	ndi_multiviewer_info.type = OBS_SOURCE_TYPE_INPUT;
+	ndi_multiviewer_info.output_flags = OBS_SOURCE_ASYNC_VIDEO |
+					    OBS_SOURCE_DO_NOT_DUPLICATE;
+
+	ndi_multiviewer_info.get_name = ndi_multiviewer_getname;
+	ndi_multiviewer_info.get_properties = ndi_multiviewer_getproperties;
+	ndi_multiviewer_info.get_defaults = ndi_multiviewer_getdefaults;
+
+	ndi_multiviewer_info.create = ndi_multiviewer_create;
+	ndi_multiviewer_info.update = ndi_multiviewer_update;
+	ndi_multiviewer_info.show = ndi_multiviewer_shown;
+	ndi_multiviewer_info.hide = ndi_multiviewer_hidden;
+	ndi_multiviewer_info.destroy = ndi_multiviewer_destroy;
+
+	return ndi_multiviewer_info;
+}
@@ -0,0 +1,946 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ndi-discovery.h"
+#include "ndi-receiver.h"
+#include "ndi-worker-pool.h"
+#include "ptz-presets-dock.h"
+
+// Captures never block, so a worker is only held while there are frames
+// to hand out. Once its queue is empty a receiver sleeps until the next
+// frame is due, going by the frame rate and audio frame length so far,
+// and wakes up this much early ...
+#define NDI_RECEIVER_EARLY_NS 2000000ULL
+// ... to look this often until the frame is in
+#define NDI_RECEIVER_LATE_POLL_NS 1000000ULL
+// A receiver is idle when no audio or video came for this long ...
+#define NDI_RECEIVER_ACTIVE_NS 1000000000ULL
+// ... and then only looks for frames this often
+#define NDI_RECEIVER_IDLE_INTERVAL_NS 100000000ULL
+// Time between looks while a sender is expected but there is nothing to
+// go by: while connecting, and until the first frames are in
+#define NDI_RECEIVER_CONNECT_POLL_NS 10000000ULL
+// Disconnected receivers wait for the discovery thread to find their
+// sender, then expect it for up to this long
+#define NDI_RECEIVER_CONNECT_WINDOW_NS 2000000000ULL
+// Fallback check for senders the discovery profiles don't see
+#define NDI_RECEIVER_DORMANT_INTERVAL_NS 1000000000ULL
+// Time between framesync pulls when not paced to the OBS frame rate
+#define NDI_RECEIVER_FRAMESYNC_INTERVAL_NS 5000000ULL
+// Metadata frames captured at most per framesync pull
+#define NDI_RECEIVER_METADATA_BURST 8
+// Backoff between attempts at creating an NDI receiver that failed
+#define NDI_RECEIVER_RETRY_MIN_NS 1000000000ULL
+#define NDI_RECEIVER_RETRY_MAX_NS 30000000000ULL
+
+typedef struct {
+	uint32_t fps_num;
+	uint32_t fps_den;
+	uint64_t frame_interval_ns;
+	uint64_t next_pull_ns;
+	uint32_t sample_rate;
+	uint64_t samples_remainder;
+} framesync_pacer_t;
+
+typedef struct {
+	const ndi_receiver_callbacks_t *callbacks;
+	void *param;
+} ndi_receiver_subscriber_t;
+
+// NDI instances frames get captured from. Held video frames keep them
+// alive, as frames have to go back to the instance they came from.
+typedef struct {
+	std::atomic<long> refs;
+	NDIlib_recv_instance_t ndi_receiver;
+	NDIlib_framesync_instance_t ndi_frame_sync;
+} ndi_receiver_instances_t;
+
+struct ndi_video_ref {
+	std::atomic<long> refs;
+	ndi_receiver_instances_t *instances;
+	NDIlib_video_frame_v2_t frame;
+};
+
+// Video frame being fanned out by the receiver task on this thread
+typedef struct {
+	ndi_receiver_instances_t *instances;
+	const NDIlib_video_frame_v2_t *frame;
+	ndi_video_ref_t *ref;
+} ndi_receiver_video_fan_out_t;
+
+static thread_local ndi_receiver_video_fan_out_t *video_fan_out = nullptr;
+
+struct ndi_receiver {
+	std::string id;
+	ndi_receiver_key_t key;
+	ndi_task_t *task;
+	std::atomic<bool> running;
+	// Set by the discovery thread when the sender showed up
+	std::atomic<bool> discovered;
+
+	// Protects the subscriber list; held while frames are fanned out so
+	// that unsubscribing guarantees no further callbacks.
+	pthread_mutex_t subscribers_mutex;
+	std::vector<ndi_receiver_subscriber_t> subscribers;
+	bool subscribers_changed;
+
+	// Receiver task only. The worker pool runs the task on one worker
+	// at a time, so this needs no locking.
+	ndi_receiver_control_t control_most_recent;
+	ndi_receiver_control_t control_last_used;
+	QByteArray ndi_receiver_name;
+	// Address the receiver was created with, empty to let NDI resolve
+	// the name
+	QByteArray ndi_url_address;
+	NDIlib_recv_create_v3_t recv_desc;
+	// Owns ndi_receiver and ndi_frame_sync
+	ndi_receiver_instances_t *instances;
+	NDIlib_recv_instance_t ndi_receiver;
+	NDIlib_framesync_instance_t ndi_frame_sync;
+	int64_t timestamp_audio;
+	int64_t timestamp_video;
+	framesync_pacer_t pacer;
+	uint64_t next_stats_ns;
+	bool reset_recv;
+	uint64_t retry_interval_ns;
+	bool connected;
+	uint64_t last_frame_ns;
+	uint64_t connect_until_ns;
+	// Arrival of the last frame of each stream and the time between
+	// frames it announced, 0 until there was one
+	uint64_t last_video_ns;
+	uint64_t video_interval_ns;
+	uint64_t last_audio_ns;
+	uint64_t audio_interval_ns;
+	uint64_t framesync_video_duplicated;
+	uint64_t framesync_video_dropped;
+	uint64_t video_discarded;
+};
+
+static pthread_mutex_t receivers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, ndi_receiver_t *> receivers;
+
+static std::string ndi_receiver_key_id(const ndi_receiver_key_t *key)
+{
+	return std::string(key->ndi_source_name.constData()) + "|" +
+	       std::to_string((int)key->bandwidth) + "|" +
+	       std::to_string((int)key->color_format) + "|" +
+	       (key->framesync_enabled ? (key->framesync_pacing ? "p" : "f")
+				       : "-") +
+	       (key->newest_video_only ? "|n" : "");
+}
+
+bool ndi_receiver_key_equals(const ndi_receiver_key_t *a,
+			     const ndi_receiver_key_t *b)
+{
+	return ndi_receiver_key_id(a) == ndi_receiver_key_id(b);
+}
+
+static void framesync_pacer_reset(framesync_pacer_t *pacer)
+{
+	obs_video_info ovi = {};
+	obs_audio_info oai = {};
+	obs_get_video_info(&ovi);
+	obs_get_audio_info(&oai);
+
+	pacer->fps_num = ovi.fps_num ? ovi.fps_num : 30;
+	pacer->fps_den = ovi.fps_den ? ovi.fps_den : 1;
+	pacer->frame_interval_ns =
+		1000000000ULL * pacer->fps_den / pacer->fps_num;
+	pacer->next_pull_ns = os_gettime_ns();
+	pacer->sample_rate = oai.samples_per_sec ? oai.samples_per_sec : 48000;
+	pacer->samples_remainder = 0;
+}
+
+// Number of audio samples covering the next canvas frame. The fractional
+// part (e.g. 48000 / 29.97) is carried over to the following frames.
+static int framesync_pacer_audio_samples(framesync_pacer_t *pacer)
+{
+	pacer->samples_remainder +=
+		(uint64_t)pacer->sample_rate * pacer->fps_den;
+	uint64_t samples = pacer->samples_remainder / pacer->fps_num;
+	pacer->samples_remainder -= samples * pacer->fps_num;
+	return (int)samples;
+}
+
+// Time of the next pull
+static uint64_t framesync_pacer_next(framesync_pacer_t *pacer)
+{
+	pacer->next_pull_ns += pacer->frame_interval_ns;
+
+	// More than a frame late: resync rather than burst to catch up
+	uint64_t now = os_gettime_ns();
+	if (now > pacer->next_pull_ns &&
+	    now - pacer->next_pull_ns > pacer->frame_interval_ns)
+		pacer->next_pull_ns = now;
+
+	return pacer->next_pull_ns;
+}
+
+// Subscribers only deal with v3 audio frames
+static void audio_frame_v2_to_v3(const NDIlib_audio_frame_v2_t *frame2,
+				 NDIlib_audio_frame_v3_t *frame3)
+{
+	frame3->sample_rate = frame2->sample_rate;
+	frame3->no_channels = frame2->no_channels;
+	frame3->no_samples = frame2->no_samples;
+	frame3->timecode = frame2->timecode;
+	frame3->FourCC = NDIlib_FourCC_audio_type_FLTP;
+	frame3->p_data = (uint8_t *)frame2->p_data;
+	frame3->channel_stride_in_bytes = frame2->channel_stride_in_bytes;
+	frame3->p_metadata = frame2->p_metadata;
+	frame3->timestamp = frame2->timestamp;
+}
+
+static void ndi_receiver_instances_release(ndi_receiver_instances_t *instances)
+{
+	if (!instances || --instances->refs > 0)
+		return;
+
+	if (instances->ndi_frame_sync)
+		ndiLib->framesync_destroy(instances->ndi_frame_sync);
+	if (instances->ndi_receiver)
+		ndiLib->recv_destroy(instances->ndi_receiver);
+	delete instances;
+}
+
+ndi_video_ref_t *ndi_receiver_hold_video(const NDIlib_video_frame_v2_t *frame)
+{
+	ndi_receiver_video_fan_out_t *fan_out = video_fan_out;
+	if (!fan_out || fan_out->frame != frame)
+		return nullptr;
+
+	if (!fan_out->ref) {
+		fan_out->ref = new ndi_video_ref_t();
+		fan_out->ref->instances = fan_out->instances;
+		fan_out->ref->frame = *frame;
+		fan_out->instances->refs++;
+	}
+	fan_out->ref->refs++;
+	return fan_out->ref;
+}
+
+void ndi_video_ref_release(ndi_video_ref_t *ref)
+{
+	if (!ref || --ref->refs > 0)
+		return;
+
+	// The framesync hands out all video of a receiver that has one
+	ndi_receiver_instances_t *instances = ref->instances;
+	if (instances->ndi_frame_sync)
+		ndiLib->framesync_free_video(instances->ndi_frame_sync,
+					     &ref->frame);
+	else
+		ndiLib->recv_free_video_v2(instances->ndi_receiver,
+					   &ref->frame);
+	ndi_receiver_instances_release(instances);
+	delete ref;
+}
+
+// Returns true when a subscriber held on to the frame, which then goes
+// back to NDI with the last ndi_video_ref_release() instead
+static bool ndi_receiver_fan_out_video(ndi_receiver_t *r,
+				       NDIlib_video_frame_v2_t *frame)
+{
+	uint64_t capture_ns = os_gettime_ns();
+	ndi_receiver_video_fan_out_t fan_out = {r->instances, frame, nullptr};
+
+	pthread_mutex_lock(&r->subscribers_mutex);
+	video_fan_out = &fan_out;
+	for (auto &sub : r->subscribers)
+		sub.callbacks->video(sub.param, frame, capture_ns);
+	video_fan_out = nullptr;
+	pthread_mutex_unlock(&r->subscribers_mutex);
+
+	return fan_out.ref != nullptr;
+}
+
+static void ndi_receiver_fan_out_audio(ndi_receiver_t *r,
+				       NDIlib_audio_frame_v3_t *frame)
+{
+	pthread_mutex_lock(&r->subscribers_mutex);
+	for (auto &sub : r->subscribers)
+		sub.callbacks->audio(sub.param, frame);
+	pthread_mutex_unlock(&r->subscribers_mutex);
+}
+
+static void ndi_receiver_fan_out_metadata(ndi_receiver_t *r,
+					  NDIlib_metadata_frame_t *frame)
+{
+	pthread_mutex_lock(&r->subscribers_mutex);
+	for (auto &sub : r->subscribers)
+		sub.callbacks->metadata(sub.param, frame);
+	pthread_mutex_unlock(&r->subscribers_mutex);
+}
+
+static void ndi_receiver_sample_stats(ndi_receiver_t *r,
+				      NDIlib_recv_instance_t ndi_receiver)
+{
+	ndi_receiver_stats_t stats = {};
+	ndiLib->recv_get_performance(ndi_receiver, &stats.total,
+				     &stats.dropped);
+	ndiLib->recv_get_queue(ndi_receiver, &stats.queue);
+	stats.framesync_video_duplicated = r->framesync_video_duplicated;
+	stats.framesync_video_dropped = r->framesync_video_dropped;
+	stats.video_discarded = r->video_discarded;
+
+	pthread_mutex_lock(&r->subscribers_mutex);
+	for (auto &sub : r->subscribers)
+		sub.callbacks->stats(sub.param, &stats);
+	pthread_mutex_unlock(&r->subscribers_mutex);
+}
+
+// Returns true and refreshes *control when any subscriber changed
+static bool ndi_receiver_sync_subscribers(ndi_receiver_t *r,
+					  ndi_receiver_control_t *control)
+{
+	pthread_mutex_lock(&r->subscribers_mutex);
+	bool changed = r->subscribers_changed;
+	r->subscribers_changed = false;
+	for (auto &sub : r->subscribers) {
+		if (sub.callbacks->sync_config(sub.param))
+			changed = true;
+	}
+	if (changed) {
+		*control = {};
+		for (auto &sub : r->subscribers)
+			sub.callbacks->get_control(sub.param, control);
+	}
+	pthread_mutex_unlock(&r->subscribers_mutex);
+	return changed;
+}
+
+static void ndi_receiver_log_framesync_stats(ndi_receiver_t *r)
+{
+	blog(LOG_INFO,
+	     "[obs-ndi] ndi_receiver_task: '%s' framesync video frames duplicated=%llu, dropped=%llu",
+	     r->key.ndi_source_name.constData(),
+	     (unsigned long long)r->framesync_video_duplicated,
+	     (unsigned long long)r->framesync_video_dropped);
+}
+
+// Frames still held keep the instances around until they are released
+static void ndi_receiver_release_instances(ndi_receiver_t *r)
+{
+	if (r->ndi_frame_sync)
+		ndi_receiver_log_framesync_stats(r);
+
+	ndi_receiver_instances_release(r->instances);
+	r->instances = nullptr;
+	r->ndi_frame_sync = nullptr;
+	r->ndi_receiver = nullptr;
+}
+
+static void ndi_receiver_destroy_recv(ndi_receiver_t *r)
+{
+	if (r->video_discarded) {
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' stale video frames skipped=%llu",
+		     r->key.ndi_source_name.constData(),
+		     (unsigned long long)r->video_discarded);
+	}
+
+	// Don't leave the PTZ dock with a dangling receiver
+	if (r->ndi_receiver)
+		ptz_presets_set_ndiname_recv_map(
+			r->key.ndi_source_name.constData(), nullptr);
+
+	ndi_receiver_release_instances(r);
+}
+
+static bool ndi_receiver_create_recv(ndi_receiver_t *r)
+{
+	const char *ndi_source_name = r->key.ndi_source_name.constData();
+
+	blog(LOG_INFO,
+	     "[obs-ndi] ndi_receiver_task: '%s' Resetting NDI receiver (bandwidth=%d, color_format=%d, framesync=%s)...",
+	     ndi_source_name, r->recv_desc.bandwidth, r->recv_desc.color_format,
+	     r->key.framesync_enabled ? "enabled" : "disabled");
+
+	ndi_receiver_release_instances(r);
+
+	// Controls have to be sent again to the new receiver
+	r->control_last_used = {};
+
+	// Connect straight away when the address is known, possibly from the
+	// discovery cache, instead of waiting for NDI to find the sender
+	ndi_discovery_source_t source;
+	r->connected = false;
+	r->connect_until_ns = 0;
+	if (ndi_discovery_find_source(ndi_source_name, &source)) {
+		r->ndi_url_address = source.url_address;
+		if (source.live)
+			r->connect_until_ns = os_gettime_ns() +
+					      NDI_RECEIVER_CONNECT_WINDOW_NS;
+	} else {
+		r->ndi_url_address.clear();
+	}
+	r->recv_desc.source_to_connect_to.p_url_address =
+		r->ndi_url_address.isEmpty() ? nullptr
+					     : r->ndi_url_address.constData();
+	r->video_discarded = 0;
+
+	r->ndi_receiver = ndiLib->recv_create_v3(&r->recv_desc);
+	if (!r->ndi_receiver) {
+		blog(LOG_ERROR,
+		     "[obs-ndi] ndi_receiver_task: Cannot create ndi_receiver for NDI source '%s'",
+		     ndi_source_name);
+		return false;
+	}
+	r->instances = new ndi_receiver_instances_t();
+	r->instances->refs = 1;
+	r->instances->ndi_receiver = r->ndi_receiver;
+	ptz_presets_set_ndiname_recv_map(ndi_source_name, r->ndi_receiver);
+
+	if (r->key.framesync_enabled) {
+		r->timestamp_audio = 0;
+		r->timestamp_video = 0;
+		r->framesync_video_duplicated = 0;
+		r->framesync_video_dropped = 0;
+
+		r->ndi_frame_sync = ndiLib->framesync_create(r->ndi_receiver);
+		if (!r->ndi_frame_sync) {
+			blog(LOG_ERROR,
+			     "[obs-ndi] ndi_receiver_task: Cannot create ndi_frame_sync for NDI source '%s'",
+			     ndi_source_name);
+			return false;
+		}
+		r->instances->ndi_frame_sync = r->ndi_frame_sync;
+
+		if (r->key.framesync_pacing) {
+			framesync_pacer_reset(&r->pacer);
+			blog(LOG_INFO,
+			     "[obs-ndi] ndi_receiver_task: '%s' framesync paced at %u/%u fps, %u Hz",
+			     ndi_source_name, r->pacer.fps_num,
+			     r->pacer.fps_den, r->pacer.sample_rate);
+		}
+	}
+
+	return true;
+}
+
+static void ndi_receiver_send_controls(ndi_receiver_t *r)
+{
+	const char *ndi_source_name = r->key.ndi_source_name.constData();
+	ndi_receiver_control_t *control_most_recent = &r->control_most_recent;
+	ndi_receiver_control_t *control_last_used = &r->control_last_used;
+
+	if (control_most_recent->hw_accel_enabled !=
+	    control_last_used->hw_accel_enabled) {
+		control_last_used->hw_accel_enabled =
+			control_most_recent->hw_accel_enabled;
+
+		NDIlib_metadata_frame_t hwAccelMetadata;
+		hwAccelMetadata.p_data =
+			control_most_recent->hw_accel_enabled
+				? (char *)"<ndi_hwaccel enabled=\"true\"/>"
+				: (char *)"<ndi_hwaccel enabled=\"false\"/>";
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' hw_accel_enabled changed; Sending NDI metadata '%s'",
+		     ndi_source_name, hwAccelMetadata.p_data);
+		ndiLib->recv_send_metadata(r->ndi_receiver, &hwAccelMetadata);
+	}
+
+	if (control_most_recent->ptz_enabled) {
+		const static float tollerance = 0.001f;
+		if (fabs(control_most_recent->pan - control_last_used->pan) >
+			    tollerance ||
+		    fabs(control_most_recent->tilt - control_last_used->tilt) >
+			    tollerance ||
+		    fabs(control_most_recent->zoom - control_last_used->zoom) >
+			    tollerance) {
+			if (ndiLib->recv_ptz_is_supported(r->ndi_receiver)) {
+				control_last_used->pan =
+					control_most_recent->pan;
+				control_last_used->tilt =
+					control_most_recent->tilt;
+				control_last_used->zoom =
+					control_most_recent->zoom;
+
+				blog(LOG_INFO,
+				     "[obs-ndi] ndi_receiver_task: '%s' ptz changed; Sending PTZ pan=%f, tilt=%f, zoom=%f",
+				     ndi_source_name, control_most_recent->pan,
+				     control_most_recent->tilt,
+				     control_most_recent->zoom);
+				ndiLib->recv_ptz_pan_tilt(
+					r->ndi_receiver,
+					control_most_recent->pan,
+					control_most_recent->tilt);
+				ndiLib->recv_ptz_zoom(r->ndi_receiver,
+						      control_most_recent->zoom);
+			}
+		}
+	}
+
+	if (control_most_recent->tally.on_preview !=
+		    control_last_used->tally.on_preview ||
+	    control_most_recent->tally.on_program !=
+		    control_last_used->tally.on_program) {
+		control_last_used->tally = control_most_recent->tally;
+
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' tally changed; Sending tally on_preview=%d, on_program=%d",
+		     ndi_source_name, control_most_recent->tally.on_preview,
+		     control_most_recent->tally.on_program);
+		ndiLib->recv_set_tally(r->ndi_receiver,
+				       &control_most_recent->tally);
+	}
+}
+
+// The framesync only deals with audio and video, metadata still comes
+// from the receiver itself
+static void ndi_receiver_capture_metadata(ndi_receiver_t *r)
+{
+	for (int i = 0; i < NDI_RECEIVER_METADATA_BURST; i++) {
+		NDIlib_metadata_frame_t metadata_frame;
+		NDIlib_frame_type_e frame_received = ndiLib->recv_capture_v3(
+			r->ndi_receiver, nullptr, nullptr, &metadata_frame, 0);
+
+		if (frame_received == NDIlib_frame_type_metadata) {
+			ndi_receiver_fan_out_metadata(r, &metadata_frame);
+			ndiLib->recv_free_metadata(r->ndi_receiver,
+						   &metadata_frame);
+		} else if (frame_received == NDIlib_frame_type_status_change) {
+			ptz_presets_set_ndiname_recv_map(
+				r->key.ndi_source_name.constData(),
+				r->ndi_receiver);
+		} else {
+			break;
+		}
+	}
+}
+
+// One framesync pull of audio and video. Returns when to pull next.
+static uint64_t ndi_receiver_pull_framesync(ndi_receiver_t *r)
+{
+	ndi_receiver_capture_metadata(r);
+
+	//
+	// AUDIO
+	//
+	NDIlib_audio_frame_v2_t audio_frame2 = {};
+	if (r->key.framesync_pacing) {
+		// Pull exactly one canvas frame worth of audio, resampled by
+		// the framesync to the OBS rate
+		ndiLib->framesync_capture_audio(
+			r->ndi_frame_sync, &audio_frame2,
+			(int)r->pacer.sample_rate, 0,
+			framesync_pacer_audio_samples(&r->pacer));
+	} else {
+		ndiLib->framesync_capture_audio(
+			r->ndi_frame_sync, &audio_frame2,
+			0, // "Your desired sample rate. 0 for “use source”."
+			0, // "Your desired channel count. 0 for “use source”."
+			1024);
+	}
+	if (audio_frame2.p_data &&
+	    (audio_frame2.timestamp > r->timestamp_audio)) {
+		r->timestamp_audio = audio_frame2.timestamp;
+		NDIlib_audio_frame_v3_t audio_frame3;
+		audio_frame_v2_to_v3(&audio_frame2, &audio_frame3);
+		ndi_receiver_fan_out_audio(r, &audio_frame3);
+	}
+	ndiLib->framesync_free_audio(r->ndi_frame_sync, &audio_frame2);
+
+	//
+	// VIDEO
+	//
+	NDIlib_video_frame_v2_t video_frame2 = {};
+	bool video_held = false;
+	ndiLib->framesync_capture_video(r->ndi_frame_sync, &video_frame2,
+					NDIlib_frame_format_type_progressive);
+	if (video_frame2.p_data &&
+	    (video_frame2.timestamp > r->timestamp_video)) {
+		if (r->key.framesync_pacing && r->timestamp_video &&
+		    video_frame2.frame_rate_N > 0) {
+			// Sender frames we never pulled
+			int64_t duration = 10000000LL *
+					   video_frame2.frame_rate_D /
+					   video_frame2.frame_rate_N;
+			int64_t missed = (video_frame2.timestamp -
+					  r->timestamp_video + duration / 2) /
+						 duration -
+					 1;
+			if (missed > 0)
+				r->framesync_video_dropped += missed;
+		}
+		r->timestamp_video = video_frame2.timestamp;
+		video_held = ndi_receiver_fan_out_video(r, &video_frame2);
+	} else if (r->key.framesync_pacing && video_frame2.p_data) {
+		// Framesync repeated the previous frame
+		r->framesync_video_duplicated++;
+	}
+	if (!video_held)
+		ndiLib->framesync_free_video(r->ndi_frame_sync, &video_frame2);
+
+	if (r->key.framesync_pacing)
+		return framesync_pacer_next(&r->pacer);
+	return os_gettime_ns() + NDI_RECEIVER_FRAMESYNC_INTERVAL_NS;
+}
+
+static bool ndi_receiver_video_queued(NDIlib_recv_instance_t ndi_receiver)
+{
+	NDIlib_recv_queue_t queue = {};
+	ndiLib->recv_get_queue(ndi_receiver, &queue);
+	return queue.video_frames > 0;
+}
+
+// Time the next frame of a stream is due, a little early, or UINT64_MAX
+// if the stream stopped or never started
+static uint64_t ndi_receiver_stream_due(uint64_t last_ns, uint64_t interval_ns,
+					uint64_t now)
+{
+	if (!interval_ns || now - last_ns >= NDI_RECEIVER_ACTIVE_NS)
+		return UINT64_MAX;
+	return last_ns + interval_ns -
+	       std::min<uint64_t>(interval_ns / 2, NDI_RECEIVER_EARLY_NS);
+}
+
+// When to capture again: right away while frames are queued, otherwise
+// when the next one is due
+static uint64_t ndi_receiver_next_capture(ndi_receiver_t *r)
+{
+	NDIlib_recv_queue_t queue = {};
+	ndiLib->recv_get_queue(r->ndi_receiver, &queue);
+	if (queue.video_frames > 0 || queue.audio_frames > 0 ||
+	    queue.metadata_frames > 0)
+		return 0;
+
+	const uint64_t now = os_gettime_ns();
+	if (now - r->last_frame_ns >= NDI_RECEIVER_ACTIVE_NS)
+		// Idle, e.g. metadata only or a paused sender
+		return now + NDI_RECEIVER_IDLE_INTERVAL_NS;
+
+	const uint64_t due = std::min(
+		ndi_receiver_stream_due(r->last_video_ns, r->video_interval_ns,
+					now),
+		ndi_receiver_stream_due(r->last_audio_ns, r->audio_interval_ns,
+					now));
+	if (due == UINT64_MAX)
+		return now + NDI_RECEIVER_CONNECT_POLL_NS;
+	// Frames held up on the network get looked for until they are in
+	return std::max<uint64_t>(due, now + NDI_RECEIVER_LATE_POLL_NS);
+}
+
+// Captures one frame per run so that other receivers sharing the worker
+// get their turn in between, without ever waiting for one: a worker
+// blocked in a capture would hold up the receivers queued behind it.
+static uint64_t ndi_receiver_capture(ndi_receiver_t *r)
+{
+	NDIlib_video_frame_v2_t video_frame2;
+	NDIlib_audio_frame_v3_t audio_frame3;
+	NDIlib_metadata_frame_t metadata_frame;
+	NDIlib_frame_type_e frame_received = ndiLib->recv_capture_v3(
+		r->ndi_receiver, &video_frame2, &audio_frame3, &metadata_frame,
+		0);
+
+	switch (frame_received) {
+	case NDIlib_frame_type_audio:
+		r->last_frame_ns = r->last_audio_ns = os_gettime_ns();
+		if (audio_frame3.sample_rate > 0)
+			r->audio_interval_ns = 1000000000ULL *
+					       audio_frame3.no_samples /
+					       audio_frame3.sample_rate;
+		ndi_receiver_fan_out_audio(r, &audio_frame3);
+		ndiLib->recv_free_audio_v3(r->ndi_receiver, &audio_frame3);
+		break;
+
+	case NDIlib_frame_type_video:
+		r->last_frame_ns = r->last_video_ns = os_gettime_ns();
+		if (video_frame2.frame_rate_N > 0) {
+			// Fields come at twice the frame rate
+			bool field = video_frame2.frame_format_type ==
+					     NDIlib_frame_format_type_field_0 ||
+				     video_frame2.frame_format_type ==
+					     NDIlib_frame_format_type_field_1;
+			r->video_interval_ns = 1000000000ULL *
+					       video_frame2.frame_rate_D /
+					       video_frame2.frame_rate_N /
+					       (field ? 2 : 1);
+		}
+		if (r->key.newest_video_only &&
+		    ndi_receiver_video_queued(r->ndi_receiver)) {
+			// Behind real time, skip ahead to the newer frame
+			r->video_discarded++;
+		} else if (ndi_receiver_fan_out_video(r, &video_frame2)) {
+			break;
+		}
+		ndiLib->recv_free_video_v2(r->ndi_receiver, &video_frame2);
+		break;
+
+	case NDIlib_frame_type_metadata:
+		ndi_receiver_fan_out_metadata(r, &metadata_frame);
+		ndiLib->recv_free_metadata(r->ndi_receiver, &metadata_frame);
+		break;
+
+	case NDIlib_frame_type_status_change:
+		ptz_presets_set_ndiname_recv_map(
+			r->key.ndi_source_name.constData(), r->ndi_receiver);
+		break;
+
+	default:
+		break;
+	}
+
+	return ndi_receiver_next_capture(r);
+}
+
+// A receiver created with an outdated address (e.g. from the discovery
+// cache) never connects
+static bool ndi_receiver_address_changed(ndi_receiver_t *r)
+{
+	ndi_discovery_source_t source;
+	return ndi_discovery_find_source(r->key.ndi_source_name.constData(),
+					 &source) &&
+	       source.live && source.url_address != r->ndi_url_address;
+}
+
+// Not connected: look for a status change (e.g. the sender came online)
+// every so often while the sender is expected, sleep until discovery finds
+// it otherwise
+static uint64_t ndi_receiver_wait_connection(ndi_receiver_t *r)
+{
+	const char *ndi_source_name = r->key.ndi_source_name.constData();
+
+	if (r->connected) {
+		r->connected = false;
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' Disconnected",
+		     ndi_source_name);
+	}
+
+	if (ndi_receiver_address_changed(r)) {
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' NDI source moved, reconnecting",
+		     ndi_source_name);
+		r->reset_recv = true;
+		return 0;
+	}
+
+	if (ndiLib->recv_capture_v3(r->ndi_receiver, nullptr, nullptr, nullptr,
+				    0) == NDIlib_frame_type_status_change) {
+		ptz_presets_set_ndiname_recv_map(ndi_source_name,
+						 r->ndi_receiver);
+		return 0;
+	}
+
+	const uint64_t now = os_gettime_ns();
+	if (now < r->connect_until_ns)
+		return now + NDI_RECEIVER_CONNECT_POLL_NS;
+	return now + NDI_RECEIVER_DORMANT_INTERVAL_NS;
+}
+
+static uint64_t ndi_receiver_task(void *data)
+{
+	auto r = (ndi_receiver_t *)data;
+	const char *ndi_source_name = r->key.ndi_source_name.constData();
+
+	if (!r->running) {
+		ndi_receiver_destroy_recv(r);
+		blog(LOG_INFO, "[obs-ndi] -ndi_receiver_task('%s'...)",
+		     ndi_source_name);
+		return NDI_TASK_DONE;
+	}
+
+	ndi_receiver_sync_subscribers(r, &r->control_most_recent);
+
+	if (r->control_most_recent.ndi_receiver_name != r->ndi_receiver_name) {
+		r->ndi_receiver_name = r->control_most_recent.ndi_receiver_name;
+
+		r->reset_recv = true;
+		r->recv_desc.p_ndi_recv_name = r->ndi_receiver_name.constData();
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_task: '%s' ndi_receiver_name changed; Setting recv_desc.p_ndi_recv_name='%s'",
+		     ndi_source_name, r->recv_desc.p_ndi_recv_name);
+	}
+	if (r->reset_recv) {
+		if (!ndi_receiver_create_recv(r)) {
+			// Keep trying rather than leave the subscribers, and
+			// anyone subscribing to the same stream later, on a
+			// receiver that never delivers anything
+			ndi_receiver_destroy_recv(r);
+			r->retry_interval_ns = std::clamp<uint64_t>(
+				r->retry_interval_ns * 2,
+				NDI_RECEIVER_RETRY_MIN_NS,
+				NDI_RECEIVER_RETRY_MAX_NS);
+			return os_gettime_ns() + r->retry_interval_ns;
+		}
+		r->reset_recv = false;
+		r->retry_interval_ns = 0;
+	}
+
+	if (r->discovered.exchange(false))
+		r->connect_until_ns =
+			os_gettime_ns() + NDI_RECEIVER_CONNECT_WINDOW_NS;
+
+	if (ndiLib->recv_get_no_connections(r->ndi_receiver) == 0)
+		return ndi_receiver_wait_connection(r);
+
+	if (!r->connected) {
+		// Expect the first frames rather than look for them at the
+		// idle pace
+		r->connected = true;
+		r->last_frame_ns = os_gettime_ns();
+		r->video_interval_ns = 0;
+		r->audio_interval_ns = 0;
+	}
+
+	ndi_receiver_send_controls(r);
+
+	if (r->control_most_recent.stats_interval_ms) {
+		uint64_t now = os_gettime_ns();
+		if (now >= r->next_stats_ns) {
+			r->next_stats_ns =
+				now + r->control_most_recent.stats_interval_ms *
+					      1000000ULL;
+			ndi_receiver_sample_stats(r, r->ndi_receiver);
+		}
+	}
+
+	if (r->ndi_frame_sync)
+		return ndi_receiver_pull_framesync(r);
+	return ndi_receiver_capture(r);
+}
+
+// The discovery thread found a sender, or saw it move: wake whatever
+// receivers are waiting for it
+static void ndi_receiver_source_added(void *, calldata_t *cd)
+{
+	const char *ndi_name = calldata_string(cd, "ndi_name");
+	if (!ndi_name)
+		return;
+
+	pthread_mutex_lock(&receivers_mutex);
+	for (auto &it : receivers) {
+		ndi_receiver_t *r = it.second;
+		if (r->key.ndi_source_name == ndi_name) {
+			r->discovered = true;
+			ndi_task_wake(r->task);
+		}
+	}
+	pthread_mutex_unlock(&receivers_mutex);
+}
+
+ndi_receiver_t *ndi_receiver_subscribe(const ndi_receiver_key_t *key,
+				       const ndi_receiver_callbacks_t *callbacks,
+				       void *param)
+{
+	std::string id = ndi_receiver_key_id(key);
+
+	// Not under receivers_mutex, which the signal takes while the
+	// discovery thread holds the signal handler
+	static std::once_flag discovery_connected;
+	std::call_once(discovery_connected, [] {
+		signal_handler_connect(ndi_discovery_get_signal_handler(),
+				       "source_added",
+				       ndi_receiver_source_added, nullptr);
+	});
+
+	pthread_mutex_lock(&receivers_mutex);
+
+	ndi_receiver_t *r = nullptr;
+	auto it = receivers.find(id);
+	if (it != receivers.end()) {
+		r = it->second;
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_subscribe: sharing receiver '%s' (%zu subscribers)",
+		     id.c_str(), r->subscribers.size() + 1);
+	} else {
+		r = new ndi_receiver_t();
+		r->id = id;
+		r->key = *key;
+		r->recv_desc.allow_video_fields = true;
+		r->recv_desc.source_to_connect_to.p_ndi_name =
+			r->key.ndi_source_name.constData();
+		r->recv_desc.bandwidth = r->key.bandwidth;
+		r->recv_desc.color_format = r->key.color_format;
+		r->reset_recv = true;
+		pthread_mutex_init(&r->subscribers_mutex, nullptr);
+		receivers[id] = r;
+	}
+
+	pthread_mutex_lock(&r->subscribers_mutex);
+	r->subscribers.push_back({callbacks, param});
+	r->subscribers_changed = true;
+	pthread_mutex_unlock(&r->subscribers_mutex);
+
+	if (!r->running) {
+		r->running = true;
+		blog(LOG_INFO, "[obs-ndi] +ndi_receiver_task('%s'...)",
+		     r->key.ndi_source_name.constData());
+		r->task = ndi_task_start(ndi_receiver_task, r);
+	} else {
+		// Pick up the new subscriber's config without waiting for
+		// the next run
+		ndi_task_wake(r->task);
+	}
+
+	pthread_mutex_unlock(&receivers_mutex);
+
+	return r;
+}
+
+void ndi_receiver_unsubscribe(ndi_receiver_t *r, void *param)
+{
+	if (!r)
+		return;
+
+	pthread_mutex_lock(&receivers_mutex);
+
+	pthread_mutex_lock(&r->subscribers_mutex);
+	for (auto it = r->subscribers.begin(); it != r->subscribers.end();
+	     ++it) {
+		if (it->param == param) {
+			r->subscribers.erase(it);
+			break;
+		}
+	}
+	r->subscribers_changed = true;
+	bool last = r->subscribers.empty();
+	pthread_mutex_unlock(&r->subscribers_mutex);
+
+	if (last)
+		receivers.erase(r->id);
+	else
+		ndi_task_wake(r->task);
+
+	pthread_mutex_unlock(&receivers_mutex);
+
+	if (last) {
+		// Tearing down the NDI receiver takes a moment, don't hold up
+		// other sources meanwhile
+		r->running = false;
+		ndi_task_wake(r->task);
+		ndi_task_join(r->task);
+		blog(LOG_INFO,
+		     "[obs-ndi] ndi_receiver_unsubscribe: Stopped receiver task for '%s'",
+		     r->id.c_str());
+		pthread_mutex_destroy(&r->subscribers_mutex);
+		delete r;
+	}
+}
@@ -0,0 +1,96 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <obs-module.h>
+#include <QByteArray>
+
+#include "plugin-main.h"
+
+typedef struct ndi_receiver ndi_receiver_t;
+
+// Everything that needs its own NDI connection. OBS sources asking for the
+// same key share a single receiver and capture task.
+typedef struct {
+	QByteArray ndi_source_name;
+	NDIlib_recv_bandwidth_e bandwidth;
+	NDIlib_recv_color_format_e color_format;
+	bool framesync_enabled;
+	bool framesync_pacing;
+	// Without framesync: skip video frames that already have a newer one
+	// queued behind them, audio is still delivered in full
+	bool newest_video_only;
+} ndi_receiver_key_t;
+
+// State sent back to the sender, merged over all subscribers
+typedef struct {
+	QByteArray ndi_receiver_name;
+	bool hw_accel_enabled;
+	bool ptz_enabled;
+	float pan;
+	float tilt;
+	float zoom;
+	NDIlib_tally_t tally;
+	// Shortest statistics interval asked for, 0 when nobody asked
+	uint32_t stats_interval_ms;
+} ndi_receiver_control_t;
+
+// Sampled by the receiver task every stats_interval_ms
+typedef struct {
+	NDIlib_recv_performance_t total;
+	NDIlib_recv_performance_t dropped;
+	NDIlib_recv_queue_t queue;
+	uint64_t framesync_video_duplicated;
+	uint64_t framesync_video_dropped;
+	// Skipped for newest_video_only
+	uint64_t video_discarded;
+} ndi_receiver_stats_t;
+
+// All callbacks are invoked from the receiver's task on the worker pool,
+// never concurrently for the same subscriber.
+typedef struct {
+	// Pick up the subscriber's latest config; true if it changed
+	bool (*sync_config)(void *param);
+	// Merge the subscriber's contribution into the receiver controls
+	void (*get_control)(void *param, ndi_receiver_control_t *control);
+	// capture_ns is the os_gettime_ns() time the frame was captured at
+	void (*video)(void *param, NDIlib_video_frame_v2_t *frame,
+		      uint64_t capture_ns);
+	void (*audio)(void *param, NDIlib_audio_frame_v3_t *frame);
+	void (*metadata)(void *param, NDIlib_metadata_frame_t *frame);
+	void (*stats)(void *param, const ndi_receiver_stats_t *stats);
+} ndi_receiver_callbacks_t;
+
+// Video frame kept alive past the video callback, e.g. to upload it to the
+// GPU straight from NDI's buffer. It goes back to NDI once every holder
+// released it, even when the receiver was reset or stopped meanwhile.
+typedef struct ndi_video_ref ndi_video_ref_t;
+
+// Takes a reference on frame, which has to be the one passed to the video
+// callback running on this thread. Returns nullptr for any other frame,
+// e.g. one the subscriber put together itself.
+ndi_video_ref_t *ndi_receiver_hold_video(const NDIlib_video_frame_v2_t *frame);
+void ndi_video_ref_release(ndi_video_ref_t *ref);
+
+ndi_receiver_t *ndi_receiver_subscribe(const ndi_receiver_key_t *key,
+				       const ndi_receiver_callbacks_t *callbacks,
+				       void *param);
+void ndi_receiver_unsubscribe(ndi_receiver_t *receiver, void *param);
+bool ndi_receiver_key_equals(const ndi_receiver_key_t *a,
+			     const ndi_receiver_key_t *b);
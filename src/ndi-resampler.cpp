@@ -0,0 +1,219 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ndi-resampler.h"
+
+#include <util/bmem.h>
+#include <util/sse-intrin.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+// Filter length in input frames, a multiple of 4 for SSE
+#define NDI_RESAMPLER_TAPS 16
+// Frames of history before and after the output position
+#define NDI_RESAMPLER_BEFORE (NDI_RESAMPLER_TAPS / 2 - 1)
+#define NDI_RESAMPLER_AFTER (NDI_RESAMPLER_TAPS / 2)
+// Fractional positions the filter is tabulated for, weights in between
+// are interpolated
+#define NDI_RESAMPLER_PHASES 256
+// Ratio of the passband to Nyquist. Steps stay within a few hundred ppm of
+// 1, so there is no need to make room for downsampling.
+#define NDI_RESAMPLER_CUTOFF 0.95
+
+typedef struct {
+	alignas(16) float weights[NDI_RESAMPLER_PHASES + 1][NDI_RESAMPLER_TAPS];
+} ndi_resampler_filter_t;
+
+// Blackman-Harris windowed sinc, each phase normalized to unity gain
+static ndi_resampler_filter_t *ndi_resampler_make_filter()
+{
+	auto filter = new ndi_resampler_filter_t();
+	const double pi = 3.14159265358979323846;
+	const double half_width = NDI_RESAMPLER_TAPS / 2.0;
+
+	for (int phase = 0; phase <= NDI_RESAMPLER_PHASES; phase++) {
+		const double frac = (double)phase / NDI_RESAMPLER_PHASES;
+		double sum = 0.0;
+		double taps[NDI_RESAMPLER_TAPS];
+		for (int j = 0; j < NDI_RESAMPLER_TAPS; j++) {
+			const double x = (j - NDI_RESAMPLER_BEFORE) - frac;
+			const double arg = pi * NDI_RESAMPLER_CUTOFF * x;
+			const double sinc = (x == 0.0) ? 1.0 : sin(arg) / arg;
+			const double w = (x + half_width) / (2.0 * half_width);
+			const double window = 0.35875 -
+					      0.48829 * cos(2.0 * pi * w) +
+					      0.14128 * cos(4.0 * pi * w) -
+					      0.01168 * cos(6.0 * pi * w);
+			taps[j] = sinc * window;
+			sum += taps[j];
+		}
+		for (int j = 0; j < NDI_RESAMPLER_TAPS; j++)
+			filter->weights[phase][j] = (float)(taps[j] / sum);
+	}
+	return filter;
+}
+
+static const ndi_resampler_filter_t *ndi_resampler_filter()
+{
+	// Built once, never freed
+	static const ndi_resampler_filter_t *filter =
+		ndi_resampler_make_filter();
+	return filter;
+}
+
+// Weights for an output frame frac past an input frame, interpolated
+// between the two nearest phases
+static inline void interpolate_weights(const ndi_resampler_filter_t *filter,
+				       double frac, float *weights)
+{
+	const double scaled = frac * NDI_RESAMPLER_PHASES;
+	const int phase = std::min((int)scaled, NDI_RESAMPLER_PHASES - 1);
+	const __m128 t = _mm_set1_ps((float)(scaled - phase));
+	const float *a = filter->weights[phase];
+	const float *b = filter->weights[phase + 1];
+
+	for (int j = 0; j < NDI_RESAMPLER_TAPS; j += 4) {
+		__m128 va = _mm_load_ps(a + j);
+		__m128 vb = _mm_load_ps(b + j);
+		__m128 w = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), t));
+		_mm_store_ps(weights + j, w);
+	}
+}
+
+static inline float convolve(const float *src, const float *weights)
+{
+	__m128 acc = _mm_setzero_ps();
+	for (int j = 0; j < NDI_RESAMPLER_TAPS; j += 4) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + j),
+						 _mm_load_ps(weights + j)));
+	}
+	// Horizontal sum
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+}
+
+static void grow(float **buffers, uint32_t channels, size_t *size,
+		 size_t frames, size_t keep)
+{
+	if (*size >= frames)
+		return;
+
+	size_t new_size = std::max(frames, *size * 2);
+	for (uint32_t c = 0; c < channels; c++) {
+		auto grown = (float *)bmalloc(new_size * sizeof(float));
+		if (keep)
+			memcpy(grown, buffers[c], keep * sizeof(float));
+		bfree(buffers[c]);
+		buffers[c] = grown;
+	}
+	*size = new_size;
+}
+
+void ndi_resampler_reset(ndi_resampler_t *resampler)
+{
+	// History starts out silent
+	resampler->input_frames = std::min(resampler->input_size,
+					   (size_t)NDI_RESAMPLER_BEFORE);
+	for (uint32_t c = 0; c < resampler->channels; c++)
+		memset(resampler->input[c], 0,
+		       resampler->input_frames * sizeof(float));
+	resampler->position = (double)resampler->input_frames;
+}
+
+void ndi_resampler_free(ndi_resampler_t *resampler)
+{
+	for (int c = 0; c < NDI_RESAMPLER_MAX_CHANNELS; c++) {
+		bfree(resampler->input[c]);
+		bfree(resampler->output[c]);
+	}
+	*resampler = {};
+}
+
+uint32_t ndi_resampler_process(ndi_resampler_t *resampler,
+			       const float *const *input, uint32_t channels,
+			       uint32_t frames, uint32_t sample_rate,
+			       double step, double *offset)
+{
+	channels = std::min(channels, (uint32_t)NDI_RESAMPLER_MAX_CHANNELS);
+
+	if (channels != resampler->channels ||
+	    sample_rate != resampler->sample_rate ||
+	    resampler->input_size < NDI_RESAMPLER_BEFORE) {
+		ndi_resampler_free(resampler);
+		resampler->channels = channels;
+		resampler->sample_rate = sample_rate;
+		grow(resampler->input, channels, &resampler->input_size,
+		     NDI_RESAMPLER_BEFORE + frames, 0);
+		ndi_resampler_reset(resampler);
+	}
+
+	// Append the new input behind what is left of the previous one
+	const size_t first = resampler->input_frames;
+	grow(resampler->input, channels, &resampler->input_size,
+	     first + frames, first);
+	for (uint32_t c = 0; c < channels; c++)
+		memcpy(resampler->input[c] + first, input[c],
+		       frames * sizeof(float));
+	resampler->input_frames += frames;
+
+	const size_t max_output =
+		(size_t)(frames / step) + NDI_RESAMPLER_TAPS;
+	grow(resampler->output, channels, &resampler->output_size,
+	     max_output, 0);
+
+	*offset = resampler->position - (double)first;
+
+	const ndi_resampler_filter_t *filter = ndi_resampler_filter();
+	alignas(16) float weights[NDI_RESAMPLER_TAPS];
+	uint32_t produced = 0;
+	double position = resampler->position;
+
+	while (produced < max_output) {
+		const size_t index = (size_t)position;
+		if (index + NDI_RESAMPLER_AFTER >= resampler->input_frames)
+			break;
+
+		interpolate_weights(filter, position - (double)index, weights);
+		for (uint32_t c = 0; c < channels; c++) {
+			const float *src = resampler->input[c] + index -
+					   NDI_RESAMPLER_BEFORE;
+			resampler->output[c][produced] =
+				convolve(src, weights);
+		}
+		produced++;
+		position += step;
+	}
+
+	// Keep only the history the next output frame needs
+	const size_t index = (size_t)position;
+	const size_t discard =
+		std::min(index - NDI_RESAMPLER_BEFORE, resampler->input_frames);
+	if (discard) {
+		const size_t keep = resampler->input_frames - discard;
+		for (uint32_t c = 0; c < channels; c++)
+			memmove(resampler->input[c],
+				resampler->input[c] + discard,
+				keep * sizeof(float));
+		resampler->input_frames = keep;
+	}
+	resampler->position = position - (double)discard;
+
+	return produced;
+}
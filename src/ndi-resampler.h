@@ -0,0 +1,57 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Same as the number of audio channels OBS takes
+#define NDI_RESAMPLER_MAX_CHANNELS 8
+
+// Windowed-sinc resampler for planar float audio whose ratio can change by
+// fractions of a ppm from one call to the next without discontinuities,
+// to absorb clock drift between a sender and OBS. Not thread safe.
+typedef struct {
+	uint32_t channels;
+	uint32_t sample_rate;
+
+	// Input not consumed yet, preceded by the history the filter needs
+	float *input[NDI_RESAMPLER_MAX_CHANNELS];
+	size_t input_size;
+	size_t input_frames;
+	// Input frame the next output frame is taken at
+	double position;
+
+	float *output[NDI_RESAMPLER_MAX_CHANNELS];
+	size_t output_size;
+} ndi_resampler_t;
+
+// Forget buffered audio, the next call starts over
+void ndi_resampler_reset(ndi_resampler_t *resampler);
+void ndi_resampler_free(ndi_resampler_t *resampler);
+
+// Resamples frames of audio, consuming step input frames per output frame.
+// Returns the number of frames written to resampler->output. *offset
+// receives where the first of them was taken, in input frames relative to
+// the first frame of input (negative for audio of the previous call).
+// A change of channels or sample_rate resets the resampler.
+uint32_t ndi_resampler_process(ndi_resampler_t *resampler,
+			       const float *const *input, uint32_t channels,
+			       uint32_t frames, uint32_t sample_rate,
+			       double step, double *offset);
@@ -0,0 +1,393 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+
+#include <obs-module.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+#include "ndi-scale.h"
+#include "ndi-convert.h"
+#include "ndi-worker-pool.h"
+
+// Helper tasks besides the receiving thread
+#define NDI_SCALE_MAX_HELPERS 3
+// Output a band of lines should have at least to be worth handing out
+#define NDI_SCALE_BAND_BYTES (256 * 1024)
+// Helpers are woken for every pass and finish once there was none for
+// this long, e.g. after scaling got turned off
+#define NDI_SCALE_HELPER_IDLE_NS 1000000000ULL
+
+enum scale_unit {
+	SCALE_UNIT_U8,
+	SCALE_UNIT_U16,
+	SCALE_UNIT_U32,
+	SCALE_UNIT_UYVY,
+};
+
+// One plane of an NDI frame, planes follow each other in memory
+typedef struct {
+	size_t offset;
+	uint32_t stride;
+	uint32_t lines;
+	uint32_t units;
+	enum scale_unit unit;
+} scale_plane_t;
+
+#define MAX_SCALE_PLANES 3
+#define MAX_SCALE_SLICES (MAX_SCALE_PLANES * (NDI_SCALE_MAX_HELPERS + 1))
+
+// Lines of one plane to halve, whoever takes it first does it
+typedef struct {
+	const uint8_t *src;
+	uint32_t src_stride;
+	uint8_t *dst;
+	uint32_t dst_stride;
+	uint32_t lines;
+	uint32_t units;
+	enum scale_unit unit;
+} scale_slice_t;
+
+typedef struct {
+	struct ndi_scaler *scaler;
+	ndi_task_t *task;
+	// Under the scaler's mutex: the task returned NDI_TASK_DONE and
+	// has to be joined before starting it again
+	bool done;
+} scale_helper_t;
+
+struct ndi_scaler {
+	// Passes alternate between them, each halving the frame
+	uint8_t *buffers[2];
+	size_t buffer_sizes[2];
+
+	// Pass in progress
+	std::mutex mutex;
+	std::condition_variable finished;
+	scale_slice_t slices[MAX_SCALE_SLICES];
+	int slice_count;
+	int next_slice;
+	int finished_slices;
+	bool stopping;
+	// Time of the last pass handed out to the helpers
+	uint64_t last_pass_ns;
+
+	scale_helper_t helpers[NDI_SCALE_MAX_HELPERS];
+	int helper_count;
+};
+
+// Layout of a fourcc frame. Returns the number of planes, 0 for formats
+// the scaler doesn't know.
+static int frame_planes(NDIlib_FourCC_video_type_e fourcc, uint32_t width,
+			uint32_t height, uint32_t stride,
+			scale_plane_t *planes)
+{
+	const uint32_t chroma_width = (width + 1) / 2;
+	const uint32_t chroma_lines = (height + 1) / 2;
+	int count = 0;
+	size_t offset = 0;
+
+	auto add_plane = [&](uint32_t lines, uint32_t plane_stride,
+			     uint32_t units, enum scale_unit unit) {
+		planes[count].offset = offset;
+		planes[count].stride = plane_stride;
+		planes[count].lines = lines;
+		planes[count].units = units;
+		planes[count].unit = unit;
+		offset += (size_t)lines * plane_stride;
+		count++;
+	};
+
+	switch (fourcc) {
+	case NDIlib_FourCC_type_UYVY:
+		add_plane(height, stride, width / 2, SCALE_UNIT_UYVY);
+		break;
+
+	case NDIlib_FourCC_type_BGRA:
+	case NDIlib_FourCC_type_BGRX:
+	case NDIlib_FourCC_type_RGBA:
+	case NDIlib_FourCC_type_RGBX:
+		add_plane(height, stride, width, SCALE_UNIT_U32);
+		break;
+
+	case NDIlib_FourCC_type_NV12:
+		add_plane(height, stride, width, SCALE_UNIT_U8);
+		add_plane(chroma_lines, stride, chroma_width, SCALE_UNIT_U16);
+		break;
+
+	case NDIlib_FourCC_type_I420:
+	case NDIlib_FourCC_type_YV12:
+		add_plane(height, stride, width, SCALE_UNIT_U8);
+		add_plane(chroma_lines, stride / 2, chroma_width,
+			  SCALE_UNIT_U8);
+		add_plane(chroma_lines, stride / 2, chroma_width,
+			  SCALE_UNIT_U8);
+		break;
+
+	default:
+		break;
+	}
+
+	return count;
+}
+
+// Bytes of a line of the first plane of a frame width pixels wide
+static uint32_t line_bytes(enum scale_unit unit, uint32_t width)
+{
+	switch (unit) {
+	case SCALE_UNIT_U8:
+		return width;
+	case SCALE_UNIT_U32:
+		return width * 4;
+	default:
+		return width * 2;
+	}
+}
+
+static void scale_slice(const scale_slice_t *slice)
+{
+	for (uint32_t y = 0; y < slice->lines; y++) {
+		const uint8_t *a =
+			slice->src + (size_t)slice->src_stride * y * 2;
+		const uint8_t *b = a + slice->src_stride;
+		uint8_t *dst = slice->dst + (size_t)slice->dst_stride * y;
+
+		switch (slice->unit) {
+		case SCALE_UNIT_U8:
+			ndi_convert_halve_line_u8(a, b, dst, slice->units);
+			break;
+		case SCALE_UNIT_U16:
+			ndi_convert_halve_line_u16(a, b, dst, slice->units);
+			break;
+		case SCALE_UNIT_U32:
+			ndi_convert_halve_line_u32(a, b, dst, slice->units);
+			break;
+		case SCALE_UNIT_UYVY:
+			ndi_convert_halve_line_uyvy(a, b, dst, slice->units);
+			break;
+		}
+	}
+}
+
+// Does slices of the current pass until there are none left
+static void ndi_scaler_work(ndi_scaler_t *scaler)
+{
+	std::unique_lock<std::mutex> lock(scaler->mutex);
+	while (scaler->next_slice < scaler->slice_count) {
+		scale_slice_t slice = scaler->slices[scaler->next_slice++];
+		lock.unlock();
+		scale_slice(&slice);
+		lock.lock();
+		if (++scaler->finished_slices == scaler->slice_count)
+			scaler->finished.notify_all();
+	}
+}
+
+static uint64_t ndi_scaler_helper_task(void *data)
+{
+	auto helper = (scale_helper_t *)data;
+	auto scaler = helper->scaler;
+
+	ndi_scaler_work(scaler);
+
+	std::lock_guard<std::mutex> lock(scaler->mutex);
+	const uint64_t idle_until_ns =
+		scaler->last_pass_ns + NDI_SCALE_HELPER_IDLE_NS;
+	if (scaler->stopping || os_gettime_ns() >= idle_until_ns) {
+		helper->done = true;
+		return NDI_TASK_DONE;
+	}
+	return idle_until_ns;
+}
+
+// Starts the helpers that aren't running, the first time or after they
+// finished for being idle
+static void ndi_scaler_start_helpers(ndi_scaler_t *scaler)
+{
+	{
+		// Keeps helpers that are still running from finishing
+		std::lock_guard<std::mutex> lock(scaler->mutex);
+		scaler->last_pass_ns = os_gettime_ns();
+	}
+
+	for (int i = 0; i < scaler->helper_count; i++) {
+		scale_helper_t *helper = &scaler->helpers[i];
+		if (helper->task) {
+			std::lock_guard<std::mutex> lock(scaler->mutex);
+			if (!helper->done)
+				continue;
+		}
+
+		if (helper->task)
+			ndi_task_join(helper->task);
+		helper->done = false;
+		helper->task = ndi_task_start(ndi_scaler_helper_task, helper);
+	}
+}
+
+// Halves every plane of src into dst. The receiving thread does its share
+// of the work and whatever the helpers don't get to, so that a busy pool
+// only makes the pass slower.
+static void ndi_scaler_run_pass(ndi_scaler_t *scaler, const uint8_t *src,
+				const scale_plane_t *src_planes, uint8_t *dst,
+				const scale_plane_t *dst_planes, int count)
+{
+	size_t out_bytes = 0;
+	for (int p = 0; p < count; p++)
+		out_bytes += (size_t)dst_planes[p].stride * dst_planes[p].lines;
+
+	int bands = (int)std::min<size_t>(out_bytes / NDI_SCALE_BAND_BYTES,
+					  NDI_SCALE_MAX_HELPERS + 1);
+	if (bands > 1)
+		ndi_scaler_start_helpers(scaler);
+	bands = std::clamp(bands, 1, scaler->helper_count + 1);
+
+	{
+		std::lock_guard<std::mutex> lock(scaler->mutex);
+		int n = 0;
+		for (int p = 0; p < count; p++) {
+			const scale_plane_t *sp = &src_planes[p];
+			const scale_plane_t *dp = &dst_planes[p];
+			for (int band = 0; band < bands; band++) {
+				uint32_t first = dp->lines * band / bands;
+				uint32_t last = dp->lines * (band + 1) / bands;
+				scale_slice_t *slice = &scaler->slices[n++];
+				slice->src = src + sp->offset +
+					     (size_t)sp->stride * first * 2;
+				slice->src_stride = sp->stride;
+				slice->dst = dst + dp->offset +
+					     (size_t)dp->stride * first;
+				slice->dst_stride = dp->stride;
+				slice->lines = last - first;
+				slice->units = dp->units;
+				slice->unit = dp->unit;
+			}
+		}
+		scaler->slice_count = n;
+		scaler->next_slice = 0;
+		scaler->finished_slices = 0;
+	}
+
+	if (bands > 1) {
+		for (int i = 0; i < scaler->helper_count; i++)
+			ndi_task_wake(scaler->helpers[i].task);
+	}
+
+	ndi_scaler_work(scaler);
+
+	// Only for slices helpers are already busy with
+	std::unique_lock<std::mutex> lock(scaler->mutex);
+	scaler->finished.wait(lock, [scaler] {
+		return scaler->finished_slices == scaler->slice_count;
+	});
+}
+
+ndi_scaler_t *ndi_scaler_create()
+{
+	auto scaler = new ndi_scaler_t();
+	scaler->helper_count = std::clamp(os_get_logical_cores() - 1, 0,
+					  NDI_SCALE_MAX_HELPERS);
+	for (int i = 0; i < scaler->helper_count; i++)
+		scaler->helpers[i].scaler = scaler;
+	return scaler;
+}
+
+void ndi_scaler_destroy(ndi_scaler_t *scaler)
+{
+	if (!scaler)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(scaler->mutex);
+		scaler->stopping = true;
+	}
+	for (int i = 0; i < scaler->helper_count; i++) {
+		ndi_task_t *task = scaler->helpers[i].task;
+		if (!task)
+			continue;
+		ndi_task_wake(task);
+		ndi_task_join(task);
+	}
+
+	bfree(scaler->buffers[0]);
+	bfree(scaler->buffers[1]);
+	delete scaler;
+}
+
+bool ndi_scaler_process(ndi_scaler_t *scaler,
+			const NDIlib_video_frame_v2_t *frame,
+			enum ndi_scale_factor factor,
+			NDIlib_video_frame_v2_t *out)
+{
+	const int passes = (int)factor;
+	if (passes <= 0 || frame->xres <= 0 || frame->yres <= 0)
+		return false;
+
+	uint32_t width = (uint32_t)frame->xres;
+	uint32_t height = (uint32_t)frame->yres;
+	uint32_t stride = (uint32_t)frame->line_stride_in_bytes;
+	if ((width >> passes) < 16 || (height >> passes) < 16)
+		return false;
+
+	scale_plane_t src_planes[MAX_SCALE_PLANES];
+	const int count =
+		frame_planes(frame->FourCC, width, height, stride, src_planes);
+	if (!count)
+		return false;
+
+	const uint8_t *src = frame->p_data;
+	uint8_t *dst = nullptr;
+	for (int pass = 0; pass < passes; pass++) {
+		// Even sizes keep chroma planes exactly half the luma planes
+		width = (width / 2) & ~1u;
+		height = (height / 2) & ~1u;
+		stride = (line_bytes(src_planes[0].unit, width) + 31) & ~31u;
+
+		scale_plane_t dst_planes[MAX_SCALE_PLANES];
+		frame_planes(frame->FourCC, width, height, stride, dst_planes);
+		const scale_plane_t *last = &dst_planes[count - 1];
+		const size_t size =
+			last->offset + (size_t)last->stride * last->lines;
+
+		uint8_t **buffer = &scaler->buffers[pass & 1];
+		size_t *buffer_size = &scaler->buffer_sizes[pass & 1];
+		if (*buffer_size < size) {
+			bfree(*buffer);
+			*buffer = (uint8_t *)bmalloc(size);
+			*buffer_size = size;
+		}
+		dst = *buffer;
+
+		ndi_scaler_run_pass(scaler, src, src_planes, dst, dst_planes,
+				    count);
+
+		src = dst;
+		for (int p = 0; p < count; p++)
+			src_planes[p] = dst_planes[p];
+	}
+
+	*out = *frame;
+	out->xres = (int)width;
+	out->yres = (int)height;
+	out->line_stride_in_bytes = (int)stride;
+	out->p_data = dst;
+	return true;
+}
@@ -0,0 +1,50 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+
+#pragma once
+
+#include <obs-module.h>
+
+#include "plugin-main.h"
+
+// Output size of a source's video compared to the NDI frames, per axis
+enum ndi_scale_factor {
+	NDI_SCALE_NONE,
+	NDI_SCALE_HALF,
+	NDI_SCALE_QUARTER,
+};
+
+// Box filters NDI frames down in the receive path, so that OBS uploads and
+// caches small frames instead of scaling large ones on the GPU. Lines of
+// large frames are shared out to helper tasks on the worker pool, which
+// only run while there are such frames. Not thread safe, meant to be owned
+// by the thread receiving the frames.
+typedef struct ndi_scaler ndi_scaler_t;
+
+ndi_scaler_t *ndi_scaler_create();
+void ndi_scaler_destroy(ndi_scaler_t *scaler);
+
+// Scales frame down by factor into a buffer of the scaler and describes the
+// result in out, valid until the next call. Returns false if there is
+// nothing to do or frame's pixel format isn't supported (UYVY, NV12, I420,
+// YV12 and the 32-bit RGB formats are), frame is used as it is then.
+bool ndi_scaler_process(ndi_scaler_t *scaler,
+			const NDIlib_video_frame_v2_t *frame,
+			enum ndi_scale_factor factor,
+			NDIlib_video_frame_v2_t *out);
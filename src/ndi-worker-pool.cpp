@@ -0,0 +1,271 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ndi-worker-pool.h"
+
+// Timers due this close to each other are run off the same wakeup
+#define NDI_WORKER_POOL_TIMER_SLACK_NS 1000000ULL
+
+enum ndi_task_state {
+	// In the run queue of a worker
+	NDI_TASK_READY,
+	// In the timer list
+	NDI_TASK_WAITING,
+	NDI_TASK_RUNNING,
+	// Running, and woken meanwhile: run again right away
+	NDI_TASK_WOKEN,
+	NDI_TASK_FINISHED,
+};
+
+struct ndi_task {
+	ndi_task_run_t run;
+	void *param;
+
+	// Changes under the pool mutex, except when the worker holding the
+	// task takes it out of or puts it back in a run queue
+	std::atomic<int> state;
+	// The end of the timer list for tasks waiting for ndi_task_wake()
+	std::multimap<uint64_t, ndi_task_t *>::iterator timer;
+	// Worker that ran the task last, its queue gets the task back
+	size_t worker;
+
+	os_event_t *finished;
+};
+
+typedef struct {
+	std::mutex mutex;
+	std::deque<ndi_task_t *> queue;
+} ndi_worker_t;
+
+static struct {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<ndi_worker_t *> workers;
+	std::vector<std::thread> threads;
+	std::multimap<uint64_t, ndi_task_t *> timers;
+	std::atomic<int> ready_count;
+	size_t next_worker;
+	bool stopping;
+} pool;
+
+static void ndi_worker_pool_push(ndi_task_t *task, size_t worker)
+{
+	task->state = NDI_TASK_READY;
+	ndi_worker_t *w = pool.workers[worker];
+	std::lock_guard<std::mutex> lock(w->mutex);
+	w->queue.push_back(task);
+	pool.ready_count++;
+}
+
+static ndi_task_t *ndi_worker_pool_pop(size_t self)
+{
+	const size_t count = pool.workers.size();
+	for (size_t i = 0; i < count; i++) {
+		ndi_worker_t *w = pool.workers[(self + i) % count];
+		std::lock_guard<std::mutex> lock(w->mutex);
+		if (w->queue.empty())
+			continue;
+
+		// Own work in order, stolen work from the other end
+		ndi_task_t *task;
+		if (i == 0) {
+			task = w->queue.front();
+			w->queue.pop_front();
+		} else {
+			task = w->queue.back();
+			w->queue.pop_back();
+		}
+		pool.ready_count--;
+		return task;
+	}
+	return nullptr;
+}
+
+// Pool mutex held. Moves the timers that are due to the worker's queue;
+// returns false if there were none.
+static bool ndi_worker_pool_take_timers(size_t self)
+{
+	uint64_t now = os_gettime_ns();
+	int taken = 0;
+	while (!pool.timers.empty() &&
+	       pool.timers.begin()->first <=
+		       now + NDI_WORKER_POOL_TIMER_SLACK_NS) {
+		ndi_task_t *task = pool.timers.begin()->second;
+		pool.timers.erase(pool.timers.begin());
+		ndi_worker_pool_push(task, self);
+		taken++;
+	}
+
+	// Let idle workers steal what this one can't get to right away
+	for (int i = 1; i < taken; i++)
+		pool.cv.notify_one();
+
+	return taken > 0;
+}
+
+static void ndi_worker_pool_reschedule(ndi_task_t *task, uint64_t next_ns,
+				       size_t self)
+{
+	if (next_ns == NDI_TASK_DONE) {
+		task->state = NDI_TASK_FINISHED;
+		// The joiner frees the task, don't touch it after this
+		os_event_signal(task->finished);
+		return;
+	}
+
+	if (next_ns == 0 || next_ns <= os_gettime_ns()) {
+		ndi_worker_pool_push(task, self);
+		// Not under the pool mutex: missing a sleeping worker here
+		// only means this worker runs the task itself
+		pool.cv.notify_one();
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	if (task->state == NDI_TASK_WOKEN) {
+		ndi_worker_pool_push(task, self);
+		return;
+	}
+	task->state = NDI_TASK_WAITING;
+	if (next_ns == NDI_TASK_SLEEP) {
+		task->timer = pool.timers.end();
+		return;
+	}
+	task->timer = pool.timers.emplace(next_ns, task);
+	if (task->timer == pool.timers.begin())
+		pool.cv.notify_one();
+}
+
+static void ndi_worker_thread(size_t self)
+{
+	os_set_thread_name("obs-ndi: worker");
+
+	for (;;) {
+		ndi_task_t *task = ndi_worker_pool_pop(self);
+		if (task) {
+			task->state = NDI_TASK_RUNNING;
+			task->worker = self;
+			uint64_t next_ns = task->run(task->param);
+			ndi_worker_pool_reschedule(task, next_ns, self);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(pool.mutex);
+		if (pool.stopping)
+			break;
+		if (ndi_worker_pool_take_timers(self) || pool.ready_count > 0)
+			continue;
+
+		if (pool.timers.empty()) {
+			pool.cv.wait(lock);
+		} else {
+			uint64_t now = os_gettime_ns();
+			uint64_t due = pool.timers.begin()->first;
+			pool.cv.wait_for(lock, std::chrono::nanoseconds(
+						       due > now ? due - now
+								 : 0));
+		}
+	}
+}
+
+ndi_task_t *ndi_task_start(ndi_task_run_t run, void *param)
+{
+	auto task = new ndi_task_t();
+	task->run = run;
+	task->param = param;
+	os_event_init(&task->finished, OS_EVENT_TYPE_MANUAL);
+
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if (pool.threads.empty()) {
+			size_t count =
+				(size_t)std::max(os_get_logical_cores(), 2);
+			pool.stopping = false;
+			for (size_t i = 0; i < count; i++)
+				pool.workers.push_back(new ndi_worker_t());
+			for (size_t i = 0; i < count; i++)
+				pool.threads.emplace_back(ndi_worker_thread, i);
+			blog(LOG_INFO,
+			     "[obs-ndi] ndi_worker_pool: Started %zu worker threads",
+			     count);
+		}
+
+		task->worker = pool.next_worker++ % pool.workers.size();
+		ndi_worker_pool_push(task, task->worker);
+	}
+	pool.cv.notify_one();
+
+	return task;
+}
+
+void ndi_task_wake(ndi_task_t *task)
+{
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	int state = NDI_TASK_RUNNING;
+	if (task->state == NDI_TASK_WAITING) {
+		if (task->timer != pool.timers.end())
+			pool.timers.erase(task->timer);
+		ndi_worker_pool_push(task, task->worker);
+		pool.cv.notify_one();
+	} else {
+		// Picked up by the worker when it reschedules the task
+		task->state.compare_exchange_strong(state, NDI_TASK_WOKEN);
+	}
+}
+
+void ndi_task_join(ndi_task_t *task)
+{
+	os_event_wait(task->finished);
+	os_event_destroy(task->finished);
+	delete task;
+}
+
+void ndi_worker_pool_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if (pool.threads.empty())
+			return;
+		pool.stopping = true;
+	}
+	pool.cv.notify_all();
+
+	for (auto &thread : pool.threads)
+		thread.join();
+	pool.threads.clear();
+
+	for (auto w : pool.workers)
+		delete w;
+	pool.workers.clear();
+	pool.timers.clear();
+
+	blog(LOG_INFO, "[obs-ndi] ndi_worker_pool: Stopped worker threads");
+}
@@ -0,0 +1,47 @@
+/*
+obs-ndi
+Copyright (C) 2016-2023 Stéphane Lepin <stephane.lepin@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Small pool of worker threads, one per logical core, shared by all the
+// recurring jobs of the plugin (e.g. NDI receivers). Each worker has its
+// own run queue and idle workers steal from the others. A task is never
+// run by two workers at once, so everything a task does happens in order.
+
+typedef struct ndi_task ndi_task_t;
+
+// Returned by a task to stop being scheduled
+#define NDI_TASK_DONE UINT64_MAX
+// Returned by a task to only run again once woken
+#define NDI_TASK_SLEEP (UINT64_MAX - 1)
+
+// Runs the task once. Returns the os_gettime_ns() time to run it again at,
+// 0 to run it again as soon as possible, NDI_TASK_SLEEP or NDI_TASK_DONE.
+typedef uint64_t (*ndi_task_run_t)(void *param);
+
+// Starts the pool on first use
+ndi_task_t *ndi_task_start(ndi_task_run_t run, void *param);
+// Run the task now instead of at the time it asked for
+void ndi_task_wake(ndi_task_t *task);
+// Wait for the task to return NDI_TASK_DONE and free it
+void ndi_task_join(ndi_task_t *task);
+
+// Stops the workers, all tasks must be joined already
+void ndi_worker_pool_shutdown();
@@ -23,36 +23,80 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <obs-module.h>
 #include <util/platform.h>
 #include <util/threading.h>
-#include <chrono>
-#include <thread>
+#include <atomic>
 #include <algorithm>
 #include <QString>
+#include <QList>
 
 #include "plugin-main.h"
 #include "Config.h"
+#include "ndi-audio.h"
+#include "ndi-clock.h"
+#include "ndi-convert.h"
+#include "ndi-dedup.h"
+#include "ndi-discovery.h"
+#include "ndi-fields.h"
+#include "ndi-gpu-video.h"
+#include "ndi-metadata.h"
+#include "ndi-receiver.h"
+#include "ndi-resampler.h"
+#include "ndi-scale.h"
+#include "ndi-worker-pool.h"
 #include "ptz-presets-dock.h"
 
 #define PROP_SOURCE "ndi_source_name"
+#define PROP_DISCOVERY_PROFILE "ndi_discovery_profile"
+#define PROP_BACKUP_SOURCES "ndi_backup_sources"
+#define PROP_FAILOVER_TIMEOUT "ndi_failover_timeout"
 #define PROP_BANDWIDTH "ndi_bw_mode"
 #define PROP_BEHAVIOR "ndi_behavior"
 #define PROP_BEHAVIOR_LASTFRAME "ndi_behavior_lastframe"
 #define PROP_SYNC "ndi_sync"
+#define PROP_SYNC_DELAY "ndi_sync_delay"
 #define PROP_FRAMESYNC "ndi_framesync"
+#define PROP_FRAMESYNC_PACING "ndi_framesync_pacing"
 #define PROP_HW_ACCEL "ndi_recv_hw_accel"
+#define PROP_HIGH_BIT_DEPTH "ndi_high_bit_depth"
 #define PROP_FIX_ALPHA "ndi_fix_alpha_blending"
 #define PROP_YUV_RANGE "yuv_range"
 #define PROP_YUV_COLORSPACE "yuv_colorspace"
 #define PROP_LATENCY "latency"
+#define PROP_SCALE "ndi_scale"
+#define PROP_DEDUP "ndi_dedup"
+#define PROP_FIELD_MODE "ndi_field_mode"
+#define PROP_FIELD_ORDER "ndi_field_order"
+#define PROP_FIELD_FALLBACK "ndi_field_fallback"
 #define PROP_AUDIO "ndi_audio"
+#define PROP_AUDIO_DRIFT "ndi_audio_drift"
+#define PROP_AUDIO_ROUTING "ndi_audio_routing"
 #define PROP_PTZ "ndi_ptz"
 #define PROP_PAN "ndi_pan"
 #define PROP_TILT "ndi_tilt"
 #define PROP_ZOOM "ndi_zoom"
+#define PROP_STATS "ndi_stats"
+#define PROP_STATS_INTERVAL "ndi_stats_interval"
 
 #define PROP_BW_UNDEFINED -1
 #define PROP_BW_HIGHEST 0
 #define PROP_BW_LOWEST 1
 #define PROP_BW_AUDIO_ONLY 2
+#define PROP_BW_AUTO 3
+
+// Time a source in "Automatic" bandwidth mode has to stay less visible
+// before its bandwidth goes down
+#define NDI_SOURCE_AUTO_BW_HOLD_NS 5000000000ULL
+
+// A switch to audio only waits this long at most for the first audio, in
+// case the sender has none
+#define NDI_SOURCE_AUDIO_STAGE_TIMEOUT_NS 2000000000ULL
+
+// Backup NDI sources past this many are ignored
+#define NDI_SOURCE_MAX_BACKUPS 4
+// Time a more preferred NDI source has to deliver video again before the
+// source fails back to it
+#define NDI_SOURCE_FAILBACK_HOLD_NS 3000000000ULL
+// Standbys are checked this many times per failover timeout
+#define NDI_SOURCE_FAILOVER_POLLS 4
 
 #define PROP_BEHAVIOR_DISCONNECT "disconnect"
 #define PROP_BEHAVIOR_KEEP "keep"
@@ -61,12 +105,15 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #define PROP_SYNC_INTERNAL 0
 #define PROP_SYNC_NDI_TIMESTAMP 1
 #define PROP_SYNC_NDI_SOURCE_TIMECODE 2
+#define PROP_SYNC_RECOVERED_CLOCK 3
 
 #define PROP_YUV_RANGE_PARTIAL 1
 #define PROP_YUV_RANGE_FULL 2
 
 #define PROP_YUV_SPACE_BT601 1
 #define PROP_YUV_SPACE_BT709 2
+#define PROP_YUV_SPACE_BT2100_PQ 3
+#define PROP_YUV_SPACE_BT2100_HLG 4
 
 #define PROP_LATENCY_UNDEFINED -1
 #define PROP_LATENCY_NORMAL 0
@@ -78,8 +125,6 @@ enum behavior_type {
 	BEHAVIOR_KEEP,
 };
 
-extern NDIlib_find_instance_t ndi_finder;
-
 typedef struct {
 	bool enabled;
 	float pan;
@@ -90,27 +135,171 @@ typedef struct {
 typedef struct {
 	QByteArray ndi_receiver_name;
 	QByteArray ndi_source_name;
+	QList<QByteArray> backup_source_names;
+	uint32_t failover_timeout_ms;
 	int bandwidth;
 	enum behavior_type behavior;
 	bool remember_last_frame;
 	int sync_mode;
+	// Recovered clock mode, on top of the mapped sender time
+	uint32_t sync_delay_ms;
 	bool framesync_enabled;
+	bool framesync_pacing;
 	bool hw_accel_enabled;
+	bool high_bit_depth;
 	video_range_type yuv_range;
 	video_colorspace yuv_colorspace;
 	int latency;
+	enum ndi_scale_factor scale;
+	// Skip frames repeating the last one, comparing every nth line; 0 is
+	// off
+	uint32_t dedup_line_step;
+	ndi_fields_config_t fields;
 	bool audio_enabled;
+	// NDI channels to OBS channels, pass-through by default
+	ndi_audio_matrix_t audio_matrix;
+	// Recovered clock mode: resample audio to the OBS clock
+	bool audio_drift_compensation;
 	ptz_t ptz;
 	NDIlib_tally_t tally;
+	uint32_t stats_interval_ms;
 	obs_source_frame *blank_frame;
 } ndi_source_config_t;
 
 typedef struct {
+	ndi_receiver_stats_t receiver;
+	uint64_t video_frames_output;
+	uint64_t audio_frames_output;
+	uint64_t video_frames_repeated;
+	// Share of the video frames of the last interval that were skipped
+	double repeated_ratio;
+	double latency_avg_ms;
+	double latency_max_ms;
+	double jitter_ms;
+	// Recovered clock mode only
+	double clock_drift_ppm;
+	uint64_t clock_relocks;
+} ndi_source_stats_t;
+
+// Running measurements of the receiver thread between two samples
+typedef struct {
+	uint64_t video_frames;
+	uint64_t audio_frames;
+	uint64_t interval_video_frames;
+	uint64_t video_repeated;
+	// Frames that went through the repeat check, and those it skipped
+	uint64_t interval_video_checked;
+	uint64_t interval_video_repeated;
+	uint64_t latency_sum_ns;
+	uint64_t latency_max_ns;
+	uint64_t last_capture_ns;
+	double jitter_ns;
+} ndi_source_stats_accum_t;
+
+enum ndi_source_subscription_role {
+	// Frames go to OBS
+	NDI_SUBSCRIPTION_LIVE,
+	// Replaces the live one once it delivers video, or audio when
+	// receiving audio only
+	NDI_SUBSCRIPTION_STAGED,
+	// Watches a backup NDI source to fail over to
+	NDI_SUBSCRIPTION_STANDBY,
+};
+
+// Subscription of a source to a shared receiver. While a source moves to
+// another receiver it has two: the live one, whose frames go to OBS, and
+// the next one, which only reports that it delivers. Sources with
+// backups additionally have a standby subscription per backup.
+typedef struct {
+	struct ndi_source *source;
+	ndi_receiver_t *receiver;
+	ndi_receiver_key_t key;
+
+	// Immutable config copies handed over to the receiver task
+	std::atomic<ndi_source_config_t *> pending_config;
+	// Receiver task only
+	ndi_source_config_t recv_config;
+
+	std::atomic<bool> live;
+	std::atomic<bool> ready;
+	std::atomic<bool> standby;
+
+	// Video health, for failover
+	std::atomic<uint64_t> last_video_ns;
+	uint64_t created_ns;
+	uint64_t healthy_since_ns;
+} ndi_source_subscription_t;
+
+typedef struct ndi_source {
 	obs_source_t *obs_source;
-	ndi_source_config_t config;
 
-	bool running;
-	pthread_t av_thread;
+	// Serializes the UI, graphics and OBS callback threads over config,
+	// subscriptions and automatic bandwidth state
+	pthread_mutex_t state_mutex;
+
+	ndi_source_config_t config;
+	ndi_source_subscription_t *subscription;
+	ndi_source_subscription_t *next_subscription;
+
+	// NDI source feeding OBS, the primary or one of the backups, and the
+	// standby subscriptions to the others, indexed like
+	// ndi_source_name_at()
+	QByteArray active_source_name;
+	ndi_source_subscription_t *standby[NDI_SOURCE_MAX_BACKUPS + 1];
+
+	// Subscriptions being torn down in the background, see
+	// ndi_source_retire
+	int retiring;
+	pthread_cond_t retired;
+
+	// Does the receiver switches the graphics thread asks for, see
+	// ndi_source_task
+	ndi_task_t *task;
+	// Under state_mutex: destroy is under way, no more switches
+	bool stopping;
+	// Set on show/hide/activate/deactivate
+	std::atomic<bool> visibility_changed;
+	// Graphics thread only: scene items generation the task was last
+	// woken for
+	uint64_t tick_scene_items_generation;
+
+	NDIlib_recv_bandwidth_e auto_bandwidth;
+	bool auto_bandwidth_pending;
+	NDIlib_recv_bandwidth_e auto_bandwidth_pending_target;
+	uint64_t auto_bandwidth_pending_since_ns;
+	// Whether the source is in any scene, as of scene_items_generation
+	bool in_any_scene;
+	uint64_t scene_items_generation;
+
+	// Output side, used by the live subscription under output_mutex
+	pthread_mutex_t output_mutex;
+	obs_source_audio obs_audio_frame;
+	obs_source_frame obs_video_frame;
+	// Destination of pixel format conversions, grown as needed
+	uint8_t *video_buffer;
+	size_t video_buffer_size;
+	// Destination of mixed audio channels, grown as needed
+	float *audio_buffer;
+	size_t audio_buffer_size;
+	// Last audio FourCC we couldn't read, to warn about it once
+	uint32_t unsupported_audio_fourcc;
+	ndi_fields_t fields;
+	ndi_scaler_t *scaler;
+	ndi_dedup_t dedup;
+	ndi_source_stats_accum_t stats_accum;
+	ndi_metadata_queue_t *metadata;
+	// Sender clock of the live subscription, for PROP_SYNC_RECOVERED_CLOCK
+	ndi_clock_t clock;
+	ndi_resampler_t resampler;
+	// GPU upload variant only, frames are drawn by the source itself
+	// instead of going to the async frame cache
+	ndi_gpu_video_t *gpu_video;
+
+	// Published by the receiver thread on every stats sample
+	pthread_mutex_t stats_mutex;
+	ndi_source_stats_t stats;
+	// A sample is waiting for ndi_source_task to signal ndi_stats
+	std::atomic<bool> stats_pending;
 } ndi_source_t;
 
 static obs_source_t *find_filter_by_id(obs_source_t *context, const char *id)
@@ -181,6 +370,10 @@ static video_colorspace prop_to_colorspace(int index)
 	switch (index) {
 	case PROP_YUV_SPACE_BT601:
 		return VIDEO_CS_601;
+	case PROP_YUV_SPACE_BT2100_PQ:
+		return VIDEO_CS_2100_PQ;
+	case PROP_YUV_SPACE_BT2100_HLG:
+		return VIDEO_CS_2100_HLG;
 	default:
 	case PROP_YUV_SPACE_BT709:
 		return VIDEO_CS_709;
@@ -198,6 +391,114 @@ static video_range_type prop_to_range_type(int index)
 	}
 }
 
+// Hand a snapshot of s->config over to the receiver tasks. A snapshot
+// that a receiver has not picked up yet is simply superseded.
+static void ndi_source_publish_config(ndi_source_t *s)
+{
+	ndi_source_subscription_t *subs[NDI_SOURCE_MAX_BACKUPS + 3] = {
+		s->subscription, s->next_subscription};
+	std::copy(std::begin(s->standby), std::end(s->standby), subs + 2);
+	for (auto sub : subs) {
+		if (!sub)
+			continue;
+		auto snapshot = new ndi_source_config_t(s->config);
+		delete sub->pending_config.exchange(snapshot,
+						    std::memory_order_acq_rel);
+	}
+}
+
+// Receiver task side: returns the latest snapshot, or nullptr when
+// nothing changed since the previous call.
+static ndi_source_config_t *
+ndi_source_take_config(ndi_source_subscription_t *sub)
+{
+	if (!sub->pending_config.load(std::memory_order_relaxed))
+		return nullptr;
+	return sub->pending_config.exchange(nullptr,
+					    std::memory_order_acquire);
+}
+
+static void ndi_source_stats_to_calldata(const ndi_source_stats_t *stats,
+					 calldata_t *cd)
+{
+	calldata_set_int(cd, "video_total", stats->receiver.total.video_frames);
+	calldata_set_int(cd, "video_dropped",
+			 stats->receiver.dropped.video_frames);
+	calldata_set_int(cd, "audio_total", stats->receiver.total.audio_frames);
+	calldata_set_int(cd, "audio_dropped",
+			 stats->receiver.dropped.audio_frames);
+	calldata_set_int(cd, "metadata_total",
+			 stats->receiver.total.metadata_frames);
+	calldata_set_int(cd, "metadata_dropped",
+			 stats->receiver.dropped.metadata_frames);
+	calldata_set_int(cd, "video_queue", stats->receiver.queue.video_frames);
+	calldata_set_int(cd, "audio_queue", stats->receiver.queue.audio_frames);
+	calldata_set_int(cd, "metadata_queue",
+			 stats->receiver.queue.metadata_frames);
+	calldata_set_int(cd, "framesync_duplicated",
+			 (long long)stats->receiver.framesync_video_duplicated);
+	calldata_set_int(cd, "framesync_dropped",
+			 (long long)stats->receiver.framesync_video_dropped);
+	calldata_set_int(cd, "video_discarded",
+			 (long long)stats->receiver.video_discarded);
+	calldata_set_int(cd, "video_output",
+			 (long long)stats->video_frames_output);
+	calldata_set_int(cd, "audio_output",
+			 (long long)stats->audio_frames_output);
+	calldata_set_int(cd, "video_repeated",
+			 (long long)stats->video_frames_repeated);
+	calldata_set_float(cd, "repeated_ratio", stats->repeated_ratio);
+	calldata_set_float(cd, "latency_avg_ms", stats->latency_avg_ms);
+	calldata_set_float(cd, "latency_max_ms", stats->latency_max_ms);
+	calldata_set_float(cd, "jitter_ms", stats->jitter_ms);
+	calldata_set_float(cd, "clock_drift_ppm", stats->clock_drift_ppm);
+	calldata_set_int(cd, "clock_relocks", (long long)stats->clock_relocks);
+}
+
+#define NDI_SOURCE_STATS_PARAMS(dir)                                      \
+	dir "int video_total, " dir "int video_dropped, " dir             \
+	    "int audio_total, " dir "int audio_dropped, " dir             \
+	    "int metadata_total, " dir "int metadata_dropped, " dir       \
+	    "int video_queue, " dir "int audio_queue, " dir               \
+	    "int metadata_queue, " dir "int framesync_duplicated, " dir   \
+	    "int framesync_dropped, " dir "int video_discarded, " dir     \
+	    "int video_output, " dir "int audio_output, " dir             \
+	    "int video_repeated, " dir "float repeated_ratio, " dir       \
+	    "float latency_avg_ms, " dir "float latency_max_ms, " dir     \
+	    "float jitter_ms, " dir "float clock_drift_ppm, " dir         \
+	    "int clock_relocks"
+
+static void ndi_source_get_stats(ndi_source_t *s, ndi_source_stats_t *stats)
+{
+	pthread_mutex_lock(&s->stats_mutex);
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->stats_mutex);
+}
+
+static void ndi_source_proc_get_stats(void *data, calldata_t *cd)
+{
+	auto s = (ndi_source_t *)data;
+	ndi_source_stats_t stats;
+	ndi_source_get_stats(s, &stats);
+	ndi_source_stats_to_calldata(&stats, cd);
+}
+
+// Latest metadata frame received with the given root element
+static void ndi_source_proc_get_metadata(void *data, calldata_t *cd)
+{
+	auto s = (ndi_source_t *)data;
+	const char *element = calldata_string(cd, "element");
+
+	QByteArray metadata;
+	int64_t timecode = 0;
+	bool found = element && ndi_metadata_queue_get_last(
+					s->metadata, element, &metadata,
+					&timecode);
+	calldata_set_bool(cd, "found", found);
+	calldata_set_string(cd, "data", metadata.constData());
+	calldata_set_int(cd, "timecode", timecode);
+}
+
 static obs_source_frame *blank_video_frame()
 {
 	obs_source_frame *frame =
@@ -211,21 +512,163 @@ const char *ndi_source_getname(void *)
 	return obs_module_text("NDIPlugin.NDISourceName");
 }
 
-obs_properties_t *ndi_source_getproperties(void *)
+const char *ndi_source_gpu_getname(void *)
+{
+	return obs_module_text("NDIPlugin.NDISourceGPUName");
+}
+
+static void ndi_source_add_stats_properties(obs_properties_t *group_stats,
+					    ndi_source_t *s)
+{
+	obs_property_t *interval = obs_properties_add_int(
+		group_stats, PROP_STATS_INTERVAL,
+		obs_module_text("NDIPlugin.SourceProps.Stats.Interval"), 0,
+		60000, 100);
+	obs_property_int_set_suffix(interval, " ms");
+
+	if (!s)
+		return;
+
+	ndi_source_stats_t stats;
+	ndi_source_get_stats(s, &stats);
+
+	auto add_info = [group_stats](const char *name, const QString &text) {
+		obs_properties_add_text(group_stats, name,
+					text.toUtf8().constData(),
+					OBS_TEXT_INFO);
+	};
+	add_info("ndi_stats_video",
+		 QString(obs_module_text("NDIPlugin.SourceProps.Stats.Video"))
+			 .arg(stats.receiver.total.video_frames)
+			 .arg(stats.receiver.dropped.video_frames));
+	add_info("ndi_stats_audio",
+		 QString(obs_module_text("NDIPlugin.SourceProps.Stats.Audio"))
+			 .arg(stats.receiver.total.audio_frames)
+			 .arg(stats.receiver.dropped.audio_frames));
+	add_info("ndi_stats_metadata",
+		 QString(obs_module_text(
+				 "NDIPlugin.SourceProps.Stats.Metadata"))
+			 .arg(stats.receiver.total.metadata_frames)
+			 .arg(stats.receiver.dropped.metadata_frames));
+	add_info("ndi_stats_queue",
+		 QString(obs_module_text("NDIPlugin.SourceProps.Stats.Queue"))
+			 .arg(stats.receiver.queue.video_frames)
+			 .arg(stats.receiver.queue.audio_frames)
+			 .arg(stats.receiver.queue.metadata_frames));
+	add_info("ndi_stats_latency",
+		 QString(obs_module_text(
+				 "NDIPlugin.SourceProps.Stats.Latency"))
+			 .arg(stats.latency_avg_ms, 0, 'f', 2)
+			 .arg(stats.latency_max_ms, 0, 'f', 2));
+	add_info("ndi_stats_jitter",
+		 QString(obs_module_text("NDIPlugin.SourceProps.Stats.Jitter"))
+			 .arg(stats.jitter_ms, 0, 'f', 2));
+	add_info("ndi_stats_framesync",
+		 QString(obs_module_text(
+				 "NDIPlugin.SourceProps.Stats.FrameSync"))
+			 .arg(stats.receiver.framesync_video_duplicated)
+			 .arg(stats.receiver.framesync_video_dropped));
+	add_info("ndi_stats_clock",
+		 QString(obs_module_text("NDIPlugin.SourceProps.Stats.Clock"))
+			 .arg(stats.clock_drift_ppm, 0, 'f', 1)
+			 .arg(stats.clock_relocks));
+	add_info("ndi_stats_repeated",
+		 QString(obs_module_text(
+				 "NDIPlugin.SourceProps.Stats.Repeated"))
+			 .arg(stats.video_frames_repeated)
+			 .arg(stats.repeated_ratio * 100.0, 0, 'f', 1));
+	add_info("ndi_stats_discarded",
+		 QString(obs_module_text(
+				 "NDIPlugin.SourceProps.Stats.Discarded"))
+			 .arg(stats.receiver.video_discarded));
+
+	// Returning true rebuilds the properties with fresh numbers
+	obs_properties_add_button(
+		group_stats, "ndi_stats_refresh",
+		obs_module_text("NDIPlugin.SourceProps.Stats.Refresh"),
+		[](obs_properties_t *, obs_property_t *, void *) {
+			return true;
+		});
+}
+
+// Fill list with the NDI sources found by a discovery profile
+static void ndi_source_list_sources(obs_property_t *list, const char *profile)
+{
+	obs_property_list_clear(list);
+	ndi_discovery_enum_sources(
+		profile,
+		[](void *param, const ndi_discovery_source_t *source) {
+			obs_property_list_add_string(
+				(obs_property_t *)param,
+				source->ndi_name.constData(),
+				source->ndi_name.constData());
+			return true;
+		},
+		list);
+}
+
+obs_properties_t *ndi_source_getproperties(void *private_data)
 {
+	auto s = (ndi_source_t *)private_data;
 	obs_properties_t *props = obs_properties_create();
 
+	obs_property_t *profiles = obs_properties_add_list(
+		props, PROP_DISCOVERY_PROFILE,
+		obs_module_text("NDIPlugin.SourceProps.DiscoveryProfile"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	// The default profile is stored as "", whatever it is called
+	typedef struct {
+		obs_property_t *list;
+		bool first;
+	} profile_list_t;
+	profile_list_t profile_list = {profiles, true};
+	ndi_discovery_enum_profiles(
+		[](void *param, const char *name) {
+			auto list = (profile_list_t *)param;
+			obs_property_list_add_string(list->list, name,
+						     list->first ? "" : name);
+			list->first = false;
+			return true;
+		},
+		&profile_list);
+
 	obs_property_t *source_list = obs_properties_add_list(
 		props, PROP_SOURCE,
 		obs_module_text("NDIPlugin.SourceProps.SourceName"),
 		OBS_COMBO_TYPE_EDITABLE, OBS_COMBO_FORMAT_STRING);
-	uint32_t nbSources = 0;
-	const NDIlib_source_t *sources =
-		ndiLib->find_get_current_sources(ndi_finder, &nbSources);
-	for (uint32_t i = 0; i < nbSources; ++i) {
-		obs_property_list_add_string(source_list, sources[i].p_ndi_name,
-					     sources[i].p_ndi_name);
-	}
+	obs_data_t *settings =
+		s ? obs_source_get_settings(s->obs_source) : nullptr;
+	ndi_source_list_sources(
+		source_list,
+		settings ? obs_data_get_string(settings, PROP_DISCOVERY_PROFILE)
+			 : "");
+	obs_data_release(settings);
+
+#if defined(__linux__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"
+#endif
+	obs_property_set_modified_callback(profiles, [](obs_properties_t *props,
+							obs_property_t *,
+							obs_data_t *settings) {
+#if defined(__linux__)
+#pragma GCC diagnostic pop
+#endif
+		ndi_source_list_sources(
+			obs_properties_get(props, PROP_SOURCE),
+			obs_data_get_string(settings, PROP_DISCOVERY_PROFILE));
+		return true;
+	});
+
+	obs_properties_add_editable_list(
+		props, PROP_BACKUP_SOURCES,
+		obs_module_text("NDIPlugin.SourceProps.BackupSources"),
+		OBS_EDITABLE_LIST_TYPE_STRINGS, nullptr, nullptr);
+	obs_property_t *failover_timeout = obs_properties_add_int(
+		props, PROP_FAILOVER_TIMEOUT,
+		obs_module_text("NDIPlugin.SourceProps.FailoverTimeout"), 100,
+		10000, 50);
+	obs_property_int_set_suffix(failover_timeout, " ms");
 
 	obs_property_t *p = obs_properties_add_list(
 		props, PROP_BEHAVIOR,
@@ -256,6 +699,9 @@ obs_properties_t *ndi_source_getproperties(void *)
 	obs_property_list_add_int(bw_modes,
 				  obs_module_text("NDIPlugin.BWMode.AudioOnly"),
 				  PROP_BW_AUDIO_ONLY);
+	obs_property_list_add_int(bw_modes,
+				  obs_module_text("NDIPlugin.BWMode.Auto"),
+				  PROP_BW_AUTO);
 #if defined(__linux__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wshadow"
@@ -291,14 +737,69 @@ obs_properties_t *ndi_source_getproperties(void *)
 		sync_modes,
 		obs_module_text("NDIPlugin.SyncMode.NDISourceTimecode"),
 		PROP_SYNC_NDI_SOURCE_TIMECODE);
+	obs_property_list_add_int(
+		sync_modes, obs_module_text("NDIPlugin.SyncMode.RecoveredClock"),
+		PROP_SYNC_RECOVERED_CLOCK);
+#if defined(__linux__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"
+#endif
+	obs_property_set_modified_callback(sync_modes, [](obs_properties_t *props,
+							  obs_property_t *,
+							  obs_data_t *settings) {
+#if defined(__linux__)
+#pragma GCC diagnostic pop
+#endif
+		bool recovered_clock = obs_data_get_int(settings, PROP_SYNC) ==
+				       PROP_SYNC_RECOVERED_CLOCK;
+		obs_property_set_visible(
+			obs_properties_get(props, PROP_SYNC_DELAY),
+			recovered_clock);
+		obs_property_set_visible(
+			obs_properties_get(props, PROP_AUDIO_DRIFT),
+			recovered_clock);
+		return true;
+	});
+
+	obs_property_t *sync_delay = obs_properties_add_int(
+		props, PROP_SYNC_DELAY,
+		obs_module_text("NDIPlugin.SourceProps.SyncDelay"), 0, 1000, 5);
+	obs_property_int_set_suffix(sync_delay, " ms");
 
-	obs_properties_add_bool(props, PROP_FRAMESYNC,
-				obs_module_text("NDIPlugin.NDIFrameSync"));
+	obs_properties_add_bool(
+		props, PROP_AUDIO_DRIFT,
+		obs_module_text("NDIPlugin.SourceProps.AudioDrift"));
+
+	obs_property_t *framesync = obs_properties_add_bool(
+		props, PROP_FRAMESYNC, obs_module_text("NDIPlugin.NDIFrameSync"));
+#if defined(__linux__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"
+#endif
+	obs_property_set_modified_callback(framesync, [](obs_properties_t *props,
+							 obs_property_t *,
+							 obs_data_t *settings) {
+#if defined(__linux__)
+#pragma GCC diagnostic pop
+#endif
+		obs_property_set_visible(
+			obs_properties_get(props, PROP_FRAMESYNC_PACING),
+			obs_data_get_bool(settings, PROP_FRAMESYNC));
+		return true;
+	});
+
+	obs_properties_add_bool(
+		props, PROP_FRAMESYNC_PACING,
+		obs_module_text("NDIPlugin.SourceProps.FrameSyncPacing"));
 
 	obs_properties_add_bool(
 		props, PROP_HW_ACCEL,
 		obs_module_text("NDIPlugin.SourceProps.HWAccel"));
 
+	obs_properties_add_bool(
+		props, PROP_HIGH_BIT_DEPTH,
+		obs_module_text("NDIPlugin.SourceProps.HighBitDepth"));
+
 	obs_properties_add_bool(
 		props, PROP_FIX_ALPHA,
 		obs_module_text("NDIPlugin.SourceProps.AlphaBlendingFix"));
@@ -322,6 +823,10 @@ obs_properties_t *ndi_source_getproperties(void *)
 		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
 	obs_property_list_add_int(yuv_spaces, "BT.709", PROP_YUV_SPACE_BT709);
 	obs_property_list_add_int(yuv_spaces, "BT.601", PROP_YUV_SPACE_BT601);
+	obs_property_list_add_int(yuv_spaces, "BT.2100 PQ",
+				  PROP_YUV_SPACE_BT2100_PQ);
+	obs_property_list_add_int(yuv_spaces, "BT.2100 HLG",
+				  PROP_YUV_SPACE_BT2100_HLG);
 
 	obs_property_t *latency_modes = obs_properties_add_list(
 		props, PROP_LATENCY,
@@ -340,8 +845,95 @@ obs_properties_t *ndi_source_getproperties(void *)
 		obs_module_text("NDIPlugin.SourceProps.Latency.Lowest"),
 		PROP_LATENCY_LOWEST);
 
+	obs_property_t *scales = obs_properties_add_list(
+		props, PROP_SCALE, obs_module_text("NDIPlugin.SourceProps.Scale"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(
+		scales, obs_module_text("NDIPlugin.SourceProps.Scale.None"),
+		NDI_SCALE_NONE);
+	obs_property_list_add_int(
+		scales, obs_module_text("NDIPlugin.SourceProps.Scale.Half"),
+		NDI_SCALE_HALF);
+	obs_property_list_add_int(
+		scales, obs_module_text("NDIPlugin.SourceProps.Scale.Quarter"),
+		NDI_SCALE_QUARTER);
+
+	obs_property_t *dedups = obs_properties_add_list(
+		props, PROP_DEDUP, obs_module_text("NDIPlugin.SourceProps.Dedup"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(
+		dedups, obs_module_text("NDIPlugin.SourceProps.Dedup.Off"), 0);
+	obs_property_list_add_int(
+		dedups, obs_module_text("NDIPlugin.SourceProps.Dedup.Full"), 1);
+	obs_property_list_add_int(
+		dedups, obs_module_text("NDIPlugin.SourceProps.Dedup.Lines4"),
+		4);
+	obs_property_list_add_int(
+		dedups, obs_module_text("NDIPlugin.SourceProps.Dedup.Lines16"),
+		16);
+
+	obs_property_t *field_modes = obs_properties_add_list(
+		props, PROP_FIELD_MODE,
+		obs_module_text("NDIPlugin.SourceProps.FieldMode"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(
+		field_modes,
+		obs_module_text("NDIPlugin.SourceProps.FieldMode.Weave"),
+		NDI_FIELDS_WEAVE);
+	obs_property_list_add_int(
+		field_modes,
+		obs_module_text("NDIPlugin.SourceProps.FieldMode.Bob"),
+		NDI_FIELDS_BOB);
+#if defined(__linux__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"
+#endif
+	obs_property_set_modified_callback(field_modes, [](obs_properties_t *props,
+							   obs_property_t *,
+							   obs_data_t *settings) {
+#if defined(__linux__)
+#pragma GCC diagnostic pop
+#endif
+		// Bob has no fields left over to fall back for
+		obs_property_set_visible(
+			obs_properties_get(props, PROP_FIELD_FALLBACK),
+			obs_data_get_int(settings, PROP_FIELD_MODE) ==
+				NDI_FIELDS_WEAVE);
+		return true;
+	});
+
+	obs_property_t *field_orders = obs_properties_add_list(
+		props, PROP_FIELD_ORDER,
+		obs_module_text("NDIPlugin.SourceProps.FieldOrder"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(
+		field_orders,
+		obs_module_text("NDIPlugin.SourceProps.FieldOrder.TopFirst"),
+		NDI_FIELDS_TOP_FIRST);
+	obs_property_list_add_int(
+		field_orders,
+		obs_module_text("NDIPlugin.SourceProps.FieldOrder.BottomFirst"),
+		NDI_FIELDS_BOTTOM_FIRST);
+
+	obs_property_t *field_fallbacks = obs_properties_add_list(
+		props, PROP_FIELD_FALLBACK,
+		obs_module_text("NDIPlugin.SourceProps.FieldFallback"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(
+		field_fallbacks,
+		obs_module_text("NDIPlugin.SourceProps.FieldFallback.Bob"),
+		NDI_FIELDS_FALLBACK_BOB);
+	obs_property_list_add_int(
+		field_fallbacks,
+		obs_module_text("NDIPlugin.SourceProps.FieldFallback.Drop"),
+		NDI_FIELDS_FALLBACK_DROP);
+
 	obs_properties_add_bool(props, PROP_AUDIO,
 				obs_module_text("NDIPlugin.SourceProps.Audio"));
+	obs_properties_add_text(
+		props, PROP_AUDIO_ROUTING,
+		obs_module_text("NDIPlugin.SourceProps.AudioRouting"),
+		OBS_TEXT_DEFAULT);
 
 	obs_properties_t *group_ptz = obs_properties_create();
 	obs_properties_add_float_slider(
@@ -361,6 +953,12 @@ obs_properties_t *ndi_source_getproperties(void *)
 				 obs_module_text("NDIPlugin.SourceProps.PTZ"),
 				 OBS_GROUP_CHECKABLE, group_ptz);
 
+	obs_properties_t *group_stats = obs_properties_create();
+	ndi_source_add_stats_properties(group_stats, s);
+	obs_properties_add_group(props, PROP_STATS,
+				 obs_module_text("NDIPlugin.SourceProps.Stats"),
+				 OBS_GROUP_NORMAL, group_stats);
+
 	auto ndi_website = obs_module_text("NDIPlugin.NDIWebsite");
 	obs_properties_add_button2(
 		props, "ndi_website", ndi_website,
@@ -394,489 +992,226 @@ obs_properties_t *ndi_source_getproperties(void *)
 void ndi_source_getdefaults(obs_data_t *settings)
 {
 	obs_data_set_default_int(settings, PROP_BANDWIDTH, PROP_BW_HIGHEST);
+	obs_data_set_default_int(settings, PROP_FAILOVER_TIMEOUT, 500);
 	obs_data_set_default_string(settings, PROP_BEHAVIOR,
 				    PROP_BEHAVIOR_KEEP);
 	obs_data_set_default_bool(settings, PROP_BEHAVIOR_LASTFRAME, true);
 	obs_data_set_default_int(settings, PROP_SYNC,
 				 PROP_SYNC_NDI_SOURCE_TIMECODE);
+	obs_data_set_default_int(settings, PROP_SYNC_DELAY, 20);
 	obs_data_set_default_int(settings, PROP_YUV_RANGE,
 				 PROP_YUV_RANGE_PARTIAL);
 	obs_data_set_default_int(settings, PROP_YUV_COLORSPACE,
 				 PROP_YUV_SPACE_BT709);
 	obs_data_set_default_int(settings, PROP_LATENCY, PROP_LATENCY_NORMAL);
+	obs_data_set_default_int(settings, PROP_SCALE, NDI_SCALE_NONE);
+	obs_data_set_default_int(settings, PROP_DEDUP, 0);
+	obs_data_set_default_int(settings, PROP_FIELD_MODE, NDI_FIELDS_WEAVE);
+	obs_data_set_default_int(settings, PROP_FIELD_ORDER,
+				 NDI_FIELDS_TOP_FIRST);
+	obs_data_set_default_int(settings, PROP_FIELD_FALLBACK,
+				 NDI_FIELDS_FALLBACK_BOB);
 	obs_data_set_default_bool(settings, PROP_AUDIO, true);
+	obs_data_set_default_bool(settings, PROP_AUDIO_DRIFT, true);
+	obs_data_set_default_int(settings, PROP_STATS_INTERVAL, 1000);
 	ptz_presets_set_defaults(settings);
 }
 
-void ndi_source_thread_process_audio2(ndi_source_config_t *config,
-				      NDIlib_audio_frame_v2_t *ndi_audio_frame2,
-				      obs_source_t *obs_source,
-				      obs_source_audio *obs_audio_frame);
-
-void ndi_source_thread_process_audio3(ndi_source_config_t *config,
-				      NDIlib_audio_frame_v3_t *ndi_audio_frame3,
-				      obs_source_t *obs_source,
-				      obs_source_audio *obs_audio_frame);
-
-void ndi_source_thread_process_video2(ndi_source_config_t *config,
-				      NDIlib_video_frame_v2_t *ndi_video_frame2,
-				      obs_source *obs_source,
-				      obs_source_frame *obs_video_frame);
-
-void *ndi_source_thread(void *data)
+// OBS time of an NDI frame for PROP_SYNC_RECOVERED_CLOCK: the sender's
+// time mapped onto ours, free of network jitter
+static uint64_t ndi_source_recovered_time(ndi_source_t *s,
+					  const ndi_source_config_t *config,
+					  int64_t timestamp, int64_t timecode)
 {
-	auto s = (ndi_source_t *)data;
-	auto obs_source = s->obs_source;
-	QByteArray obs_source_ndi_receiver_name_utf8 =
-		QString(obs_source_get_name(obs_source)).toUtf8();
-	const char *obs_source_ndi_receiver_name =
-		obs_source_ndi_receiver_name_utf8.constData();
-	blog(LOG_INFO, "[obs-ndi] +ndi_source_thread('%s'...)",
-	     obs_source_ndi_receiver_name);
-
-	ndi_source_config_t config_most_recent = {};
-	ndi_source_config_t config_last_used = {};
-	config_last_used.bandwidth = PROP_BW_UNDEFINED;
-	config_last_used.latency = PROP_LATENCY_UNDEFINED;
-
-	obs_source_audio obs_audio_frame = {};
-	obs_source_frame obs_video_frame = {};
-
-	NDIlib_recv_create_v3_t recv_desc;
-	recv_desc.allow_video_fields = true;
-
-	NDIlib_recv_instance_t ndi_receiver = nullptr;
-	NDIlib_video_frame_v2_t video_frame2;
-
-	NDIlib_metadata_frame_t metadata_frame;
-	NDIlib_framesync_instance_t ndi_frame_sync = nullptr;
-	NDIlib_audio_frame_v2_t audio_frame2;
-	int64_t timestamp_audio = 0;
-	int64_t timestamp_video = 0;
-
-	NDIlib_audio_frame_v3_t audio_frame3;
-	NDIlib_frame_type_e frame_received = NDIlib_frame_type_none;
-
-	NDIlib_recv_create_v3_t *reset_recv_desc = &recv_desc;
-
-	while (s->running) {
-		//
-		// Main NDI receiver loop
-		//
-
-		// semi-atomic not *TOO* heavy snapshot
-		config_most_recent = s->config;
-
-		if (config_most_recent.ndi_receiver_name !=
-		    config_last_used.ndi_receiver_name) {
-			config_last_used.ndi_receiver_name =
-				config_most_recent.ndi_receiver_name;
-
-			reset_recv_desc = &recv_desc;
-			obs_source_ndi_receiver_name_utf8 =
-				config_most_recent.ndi_receiver_name;
-			obs_source_ndi_receiver_name =
-				obs_source_ndi_receiver_name_utf8.constData();
-			recv_desc.p_ndi_recv_name =
-				obs_source_ndi_receiver_name;
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' ndi_receiver_name changed; Setting recv_desc.p_ndi_recv_name='%s'",
-			     obs_source_ndi_receiver_name,
-			     recv_desc.p_ndi_recv_name);
-		}
-		if (config_most_recent.ndi_source_name !=
-		    config_last_used.ndi_source_name) {
-			config_last_used.ndi_source_name =
-				config_most_recent.ndi_source_name;
-
-			reset_recv_desc = &recv_desc;
-			recv_desc.source_to_connect_to.p_ndi_name =
-				config_most_recent.ndi_source_name;
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' ndi_source_name changed; Setting recv_desc.source_to_connect_to.p_ndi_name='%s'",
-			     obs_source_ndi_receiver_name,
-			     recv_desc.source_to_connect_to.p_ndi_name);
-		}
-		if (config_most_recent.bandwidth !=
-		    config_last_used.bandwidth) {
-			config_last_used.bandwidth =
-				config_most_recent.bandwidth;
-
-			reset_recv_desc = &recv_desc;
-			switch (config_most_recent.bandwidth) {
-			case PROP_BW_HIGHEST:
-			default:
-				recv_desc.bandwidth =
-					NDIlib_recv_bandwidth_highest;
-				break;
-			case PROP_BW_LOWEST:
-				recv_desc.bandwidth =
-					NDIlib_recv_bandwidth_lowest;
-				break;
-			case PROP_BW_AUDIO_ONLY:
-				recv_desc.bandwidth =
-					NDIlib_recv_bandwidth_audio_only;
-				obs_source_output_video(
-					obs_source,
-					config_most_recent.blank_frame);
-				break;
-			}
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' bandwidth changed; Setting recv_desc.bandwidth='%d'",
-			     obs_source_ndi_receiver_name, recv_desc.bandwidth);
-		}
-		if (config_most_recent.latency != config_last_used.latency) {
-			config_last_used.latency = config_most_recent.latency;
-
-			reset_recv_desc = &recv_desc;
-			if (config_most_recent.latency == PROP_LATENCY_NORMAL)
-				recv_desc.color_format =
-					NDIlib_recv_color_format_UYVY_BGRA;
-			else
-				recv_desc.color_format =
-					NDIlib_recv_color_format_fastest;
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' latency changed; Setting recv_desc.color_format='%d'",
-			     obs_source_ndi_receiver_name,
-			     recv_desc.color_format);
-		}
-		if (config_most_recent.framesync_enabled !=
-		    config_last_used.framesync_enabled) {
-			config_last_used.framesync_enabled =
-				config_most_recent.framesync_enabled;
-
-			reset_recv_desc = &recv_desc;
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' framesync changed to %s",
-			     obs_source_ndi_receiver_name,
-			     config_most_recent.framesync_enabled ? "enabled"
-								  : "disabled");
-		}
-		if (reset_recv_desc) {
-			reset_recv_desc = nullptr;
-
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' Resetting NDI receiver...",
-			     obs_source_ndi_receiver_name);
-
-			if (ndi_frame_sync) {
-				ndiLib->framesync_destroy(ndi_frame_sync);
-				ndi_frame_sync = nullptr;
-			}
-
-			if (ndi_receiver) {
-#if 1
-				blog(LOG_INFO,
-				     "[obs-ndi] ndi_source_thread: '%s' ndiLib->recv_destroy(ndi_receiver)",
-				     obs_source_ndi_receiver_name);
-#endif
-				ndiLib->recv_destroy(ndi_receiver);
-				ndi_receiver = nullptr;
-			}
-#if 1
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' +ndi_receiver = ndiLib->recv_create_v3(&recv_desc)",
-			     obs_source_ndi_receiver_name);
-#endif
-			ndi_receiver = ndiLib->recv_create_v3(&recv_desc);
-#if 1
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' -ndi_receiver = ndiLib->recv_create_v3(&recv_desc)",
-			     obs_source_ndi_receiver_name);
-#endif
-			if (!ndi_receiver) {
-				blog(LOG_ERROR,
-				     "[obs-ndi] ndi_source_thread: '%s' Cannot create ndi_receiver for NDI source '%s'",
-				     obs_source_ndi_receiver_name,
-				     recv_desc.source_to_connect_to.p_ndi_name);
-				break;
-			}
-			ptz_presets_set_source_ndiname_map(obs_source,
-				recv_desc.source_to_connect_to.p_ndi_name);
-			ptz_presets_set_ndiname_recv_map(
-				recv_desc.source_to_connect_to.p_ndi_name,
-				ndi_receiver);
-			
-			if (config_most_recent.framesync_enabled) {
-				timestamp_audio = 0;
-				timestamp_video = 0;
-#if 1
-				blog(LOG_INFO,
-				     "[obs-ndi] ndi_source_thread: '%s' +ndi_frame_sync = ndiLib->framesync_create(ndi_receiver)",
-				     obs_source_ndi_receiver_name);
-#endif
-				ndi_frame_sync =
-					ndiLib->framesync_create(ndi_receiver);
-#if 1
-				blog(LOG_INFO,
-				     "[obs-ndi] ndi_source_thread: '%s' -ndi_frame_sync = ndiLib->framesync_create(ndi_receiver); ndi_frame_sync=%p",
-				     obs_source_ndi_receiver_name,
-				     ndi_frame_sync);
-#endif
-				if (!ndi_frame_sync) {
-					blog(LOG_ERROR,
-					     "[obs-ndi] ndi_source_thread: '%s' Cannot create ndi_frame_sync for NDI source '%s'",
-					     obs_source_ndi_receiver_name,
-					     recv_desc.source_to_connect_to
-						     .p_ndi_name);
-					break;
-				}
-			}
-		}
-
-		if (ndiLib->recv_get_no_connections(ndi_receiver) == 0) {
-#if 0
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' No connection",
-			     obs_source_ndi_receiver_name);
-#endif
-			std::this_thread::sleep_for(
-				std::chrono::milliseconds(100));
-			continue;
-		}
-
-		if (config_most_recent.hw_accel_enabled !=
-		    config_last_used.hw_accel_enabled) {
-			config_last_used.hw_accel_enabled =
-				config_most_recent.hw_accel_enabled;
-
-			NDIlib_metadata_frame_t hwAccelMetadata;
-			hwAccelMetadata.p_data =
-				config_most_recent.hw_accel_enabled
-					? (char *)"<ndi_hwaccel enabled=\"true\"/>"
-					: (char *)"<ndi_hwaccel enabled=\"false\"/>";
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' hw_accel_enabled changed; Sending NDI metadata '%s'",
-			     obs_source_ndi_receiver_name,
-			     hwAccelMetadata.p_data);
-			ndiLib->recv_send_metadata(ndi_receiver,
-						   &hwAccelMetadata);
-		}
-
-		if (config_most_recent.ptz.enabled) {
-			const static float tollerance = 0.001f;
-			if (fabs(config_most_recent.ptz.pan -
-				 config_last_used.ptz.pan) > tollerance ||
-			    fabs(config_most_recent.ptz.tilt -
-				 config_last_used.ptz.tilt) > tollerance ||
-			    fabs(config_most_recent.ptz.zoom -
-				 config_last_used.ptz.zoom) > tollerance) {
-				if (ndiLib->recv_ptz_is_supported(
-					    ndi_receiver)) {
-					config_last_used.ptz =
-						config_most_recent.ptz;
-
-					blog(LOG_INFO,
-					     "[obs-ndi] ndi_source_thread: '%s' ptz changed; Sending PTZ pan=%f, tilt=%f, zoom=%f",
-					     obs_source_ndi_receiver_name,
-					     config_most_recent.ptz.pan,
-					     config_most_recent.ptz.tilt,
-					     config_most_recent.ptz.zoom);
-					ndiLib->recv_ptz_pan_tilt(
-						ndi_receiver,
-						config_most_recent.ptz.pan,
-						config_most_recent.ptz.tilt);
-					ndiLib->recv_ptz_zoom(
-						ndi_receiver,
-						config_most_recent.ptz.zoom);
-				}
-			}
-		}
-
-		if (config_most_recent.tally.on_preview !=
-			    config_last_used.tally.on_preview ||
-		    config_most_recent.tally.on_program !=
-			    config_last_used.tally.on_program) {
-			config_last_used.tally = config_most_recent.tally;
-
-			blog(LOG_INFO,
-			     "[obs-ndi] ndi_source_thread: '%s' tally changed; Sending tally on_preview=%d, on_program=%d",
-			     obs_source_ndi_receiver_name,
-			     config_most_recent.tally.on_preview,
-			     config_most_recent.tally.on_program);
-			ndiLib->recv_set_tally(ndi_receiver,
-					       &config_most_recent.tally);
-		}
-
-		if (ndi_frame_sync) {
-			//
-			// AUDIO
-			//
-			audio_frame2 = {};
-			ndiLib->framesync_capture_audio(
-				ndi_frame_sync, &audio_frame2,
-				0, // "Your desired sample rate. 0 for “use source”."
-				0, // "Your desired channel count. 0 for “use source”."
-				1024);
-			if (audio_frame2.p_data &&
-			    (audio_frame2.timestamp > timestamp_audio)) {
-				//blog(LOG_INFO, "a");//udio_frame";
-				timestamp_audio = audio_frame2.timestamp;
-				ndi_source_thread_process_audio2(
-					&config_most_recent, &audio_frame2,
-					obs_source, &obs_audio_frame);
-			}
-			ndiLib->framesync_free_audio(ndi_frame_sync,
-						     &audio_frame2);
-
-			//
-			// VIDEO
-			//
-			video_frame2 = {};
-			ndiLib->framesync_capture_video(
-				ndi_frame_sync, &video_frame2,
-				NDIlib_frame_format_type_progressive);
-			if (video_frame2.p_data &&
-			    (video_frame2.timestamp > timestamp_video)) {
-				//blog(LOG_INFO, "v");//ideo_frame";
-				timestamp_video = video_frame2.timestamp;
-				ndi_source_thread_process_video2(
-					&config_most_recent, &video_frame2,
-					obs_source, &obs_video_frame);
-			}
-			ndiLib->framesync_free_video(ndi_frame_sync,
-						     &video_frame2);
-
-			// TODO: More accurate sleep that subtracts the duration of this loop iteration?
-			std::this_thread::sleep_for(
-				std::chrono::milliseconds(5));
-		} else {
-			frame_received = ndiLib->recv_capture_v3(ndi_receiver,
-								 &video_frame2,
-								 &audio_frame3,
-								 nullptr, 100);
-
-			if (frame_received == NDIlib_frame_type_audio) {
-				ndi_source_thread_process_audio3(
-					&config_most_recent, &audio_frame3,
-					obs_source, &obs_audio_frame);
-				ndiLib->recv_free_audio_v3(ndi_receiver,
-							   &audio_frame3);
-				continue;
-			}
-
-			if (frame_received == NDIlib_frame_type_video) {
-				ndi_source_thread_process_video2(
-					&config_most_recent, &video_frame2,
-					obs_source, &obs_video_frame);
-				ndiLib->recv_free_video_v2(ndi_receiver,
-							   &video_frame2);
-				continue;
-			}
-
-			if (frame_received == NDIlib_frame_type_status_change) {
-				ptz_presets_set_ndiname_recv_map(
-					recv_desc.source_to_connect_to
-						.p_ndi_name,
-					ndi_receiver);
-				ptz_presets_set_source_ndiname_map(
-					obs_source,
-					recv_desc.source_to_connect_to
-						.p_ndi_name);
-				continue;
-			}
-		}
-	}
-
-	if (ndi_frame_sync) {
-		ndiLib->framesync_destroy(ndi_frame_sync);
-		ndi_frame_sync = nullptr;
-	}
+	// Senders that don't timestamp their frames still have a timecode
+	int64_t sender_time = (timestamp != NDIlib_recv_timestamp_undefined)
+				      ? timestamp
+				      : timecode;
+	return ndi_clock_update(&s->clock, sender_time * 100,
+				os_gettime_ns()) +
+	       config->sync_delay_ms * 1000000ULL;
+}
 
-	if (ndi_receiver) {
-		ndiLib->recv_destroy(ndi_receiver);
-		ndi_receiver = nullptr;
+static float *ndi_source_audio_buffer(float **buffer, size_t *buffer_size,
+				      size_t count)
+{
+	if (*buffer_size < count) {
+		bfree(*buffer);
+		*buffer = (float *)bmalloc(count * sizeof(float));
+		*buffer_size = count;
 	}
-
-	blog(LOG_INFO, "[obs-ndi] -ndi_source_thread('%s'...)",
-	     obs_source_ndi_receiver_name);
-
-	return nullptr;
+	return *buffer;
 }
 
-void ndi_source_thread_process_audio2(ndi_source_config_t *config,
-				      NDIlib_audio_frame_v2_t *ndi_audio_frame2,
-				      obs_source_t *obs_source,
-				      obs_source_audio *obs_audio_frame)
+void ndi_source_thread_process_audio3(ndi_source_t *s,
+				      const ndi_source_config_t *config,
+				      NDIlib_audio_frame_v3_t *ndi_audio_frame3)
 {
 	if (!config->audio_enabled) {
 		return;
 	}
 
-	const int channelCount = ndi_audio_frame2->no_channels > 8
-					 ? 8
-					 : ndi_audio_frame2->no_channels;
+	obs_source_audio *obs_audio_frame = &s->obs_audio_frame;
+	const ndi_audio_matrix_t *matrix = &config->audio_matrix;
+
+	// Planar float is the only audio layout the SDK defines
+	if (ndi_audio_frame3->FourCC != NDIlib_FourCC_audio_type_FLTP) {
+		if (s->unsupported_audio_fourcc != ndi_audio_frame3->FourCC) {
+			s->unsupported_audio_fourcc = ndi_audio_frame3->FourCC;
+			blog(LOG_WARNING,
+			     "[obs-ndi] ndi_source_thread_process_audio3: '%s' Unsupported audio FourCC 0x%08x, dropping audio",
+			     obs_source_get_name(s->obs_source),
+			     (uint32_t)ndi_audio_frame3->FourCC);
+		}
+		return;
+	}
+
+	const uint8_t *samples = ndi_audio_frame3->p_data;
+	const uint32_t channel_stride =
+		ndi_audio_frame3->channel_stride_in_bytes;
+	const uint32_t channels = ndi_audio_frame3->no_channels;
+
+	int channelCount = channels > 8 ? 8 : (int)channels;
+	if (matrix->outputs)
+		channelCount = (int)matrix->outputs;
 
 	obs_audio_frame->speakers = channel_count_to_layout(channelCount);
 
 	switch (config->sync_mode) {
 	case PROP_SYNC_NDI_TIMESTAMP:
 		obs_audio_frame->timestamp =
-			(uint64_t)(ndi_audio_frame2->timestamp * 100);
+			(uint64_t)(ndi_audio_frame3->timestamp * 100);
 		break;
 
 	case PROP_SYNC_NDI_SOURCE_TIMECODE:
 		obs_audio_frame->timestamp =
-			(uint64_t)(ndi_audio_frame2->timecode * 100);
+			(uint64_t)(ndi_audio_frame3->timecode * 100);
+		break;
+
+	case PROP_SYNC_RECOVERED_CLOCK:
+		obs_audio_frame->timestamp = ndi_source_recovered_time(
+			s, config, ndi_audio_frame3->timestamp,
+			ndi_audio_frame3->timecode);
 		break;
 	}
 
-	obs_audio_frame->samples_per_sec = ndi_audio_frame2->sample_rate;
+	obs_audio_frame->samples_per_sec = ndi_audio_frame3->sample_rate;
 	obs_audio_frame->format = AUDIO_FORMAT_FLOAT_PLANAR;
-	obs_audio_frame->frames = ndi_audio_frame2->no_samples;
-	for (int i = 0; i < channelCount; ++i) {
-		obs_audio_frame->data[i] =
-			(uint8_t *)ndi_audio_frame2->p_data +
-			(i * ndi_audio_frame2->channel_stride_in_bytes);
+	obs_audio_frame->frames = ndi_audio_frame3->no_samples;
+	if (matrix->outputs) {
+		const float *planes[NDI_AUDIO_MAX_OUTPUTS];
+		ndi_audio_matrix_apply(
+			matrix, samples, channel_stride, channels,
+			ndi_audio_frame3->no_samples,
+			ndi_source_audio_buffer(
+				&s->audio_buffer, &s->audio_buffer_size,
+				(size_t)ndi_audio_frame3->no_samples *
+					matrix->outputs),
+			planes);
+		for (int i = 0; i < channelCount; ++i)
+			obs_audio_frame->data[i] = (const uint8_t *)planes[i];
+	} else {
+		for (int i = 0; i < channelCount; ++i) {
+			obs_audio_frame->data[i] =
+				samples + (size_t)i * channel_stride;
+		}
+	}
+
+	if (config->sync_mode == PROP_SYNC_RECOVERED_CLOCK &&
+	    config->audio_drift_compensation && s->clock.locked) {
+		// Consume the sender's samples at the rate its clock runs
+		// compared to ours, so OBS gets them at its own rate and
+		// its buffering stays at the same depth
+		double offset = 0.0;
+		obs_audio_frame->frames = ndi_resampler_process(
+			&s->resampler, (const float *const *)obs_audio_frame->data,
+			channelCount, ndi_audio_frame3->no_samples,
+			ndi_audio_frame3->sample_rate, 1.0 / s->clock.rate,
+			&offset);
+		if (!obs_audio_frame->frames)
+			return;
+
+		for (int i = 0; i < channelCount; ++i)
+			obs_audio_frame->data[i] =
+				(uint8_t *)s->resampler.output[i];
+		// Time of the first resampled frame
+		obs_audio_frame->timestamp += (int64_t)(
+			offset * 1000000000.0 / ndi_audio_frame3->sample_rate);
 	}
 
-	obs_source_output_audio(obs_source, obs_audio_frame);
+	obs_source_output_audio(s->obs_source, obs_audio_frame);
 }
 
-void ndi_source_thread_process_audio3(ndi_source_config_t *config,
-				      NDIlib_audio_frame_v3_t *ndi_audio_frame3,
-				      obs_source_t *obs_source,
-				      obs_source_audio *obs_audio_frame)
+static uint8_t *ndi_source_video_buffer(ndi_source_t *s, size_t size)
 {
-	if (!config->audio_enabled) {
-		return;
+	if (s->video_buffer_size < size) {
+		bfree(s->video_buffer);
+		s->video_buffer = (uint8_t *)bmalloc(size);
+		s->video_buffer_size = size;
 	}
+	return s->video_buffer;
+}
 
-	const int channelCount = ndi_audio_frame3->no_channels > 8
-					 ? 8
-					 : ndi_audio_frame3->no_channels;
-
-	obs_audio_frame->speakers = channel_count_to_layout(channelCount);
-
-	switch (config->sync_mode) {
-	case PROP_SYNC_NDI_TIMESTAMP:
-		obs_audio_frame->timestamp =
-			(uint64_t)(ndi_audio_frame3->timestamp * 100);
-		break;
+static video_trc colorspace_to_trc(video_colorspace colorspace)
+{
+	switch (colorspace) {
+	case VIDEO_CS_2100_PQ:
+		return VIDEO_TRC_PQ;
+	case VIDEO_CS_2100_HLG:
+		return VIDEO_TRC_HLG;
+	default:
+		return VIDEO_TRC_DEFAULT;
+	}
+}
 
-	case PROP_SYNC_NDI_SOURCE_TIMECODE:
-		obs_audio_frame->timestamp =
-			(uint64_t)(ndi_audio_frame3->timecode * 100);
-		break;
+void ndi_source_thread_process_video2(ndi_source_t *s,
+				      const ndi_source_config_t *config,
+				      NDIlib_video_frame_v2_t *ndi_video_frame)
+{
+	if (config->dedup_line_step) {
+		auto acc = &s->stats_accum;
+		acc->interval_video_checked++;
+		if (ndi_dedup_is_repeat(&s->dedup, ndi_video_frame,
+					config->dedup_line_step,
+					os_gettime_ns())) {
+			acc->video_repeated++;
+			acc->interval_video_repeated++;
+			// OBS keeps showing the frame it has. The clock still
+			// learns from every frame.
+			if (config->sync_mode == PROP_SYNC_RECOVERED_CLOCK)
+				ndi_source_recovered_time(
+					s, config, ndi_video_frame->timestamp,
+					ndi_video_frame->timecode);
+			return;
+		}
 	}
 
-	obs_audio_frame->samples_per_sec = ndi_audio_frame3->sample_rate;
-	obs_audio_frame->format = AUDIO_FORMAT_FLOAT_PLANAR;
-	obs_audio_frame->frames = ndi_audio_frame3->no_samples;
-	for (int i = 0; i < channelCount; ++i) {
-		obs_audio_frame->data[i] =
-			(uint8_t *)ndi_audio_frame3->p_data +
-			(i * ndi_audio_frame3->channel_stride_in_bytes);
+	// Small frames are cheaper to convert, upload and cache
+	NDIlib_video_frame_v2_t scaled_frame;
+	if (config->scale != NDI_SCALE_NONE &&
+	    ndi_scaler_process(s->scaler, ndi_video_frame, config->scale,
+			       &scaled_frame))
+		ndi_video_frame = &scaled_frame;
+
+	if (s->gpu_video) {
+		// Planes go to the GPU as they are, no conversion here
+		ndi_gpu_video_submit(s->gpu_video, ndi_video_frame,
+				     config->yuv_colorspace, config->yuv_range);
+		return;
 	}
 
-	obs_source_output_audio(obs_source, obs_audio_frame);
-}
+	obs_source_frame *obs_video_frame = &s->obs_video_frame;
+	const uint32_t width = ndi_video_frame->xres;
+	const uint32_t height = ndi_video_frame->yres;
+	const uint32_t stride = ndi_video_frame->line_stride_in_bytes;
+	uint8_t *src = ndi_video_frame->p_data;
+
+	// Don't let planes of a previous frame in another format linger
+	memset(obs_video_frame->data, 0, sizeof(obs_video_frame->data));
+	memset(obs_video_frame->linesize, 0, sizeof(obs_video_frame->linesize));
+	obs_video_frame->data[0] = src;
+	obs_video_frame->linesize[0] = stride;
 
-void ndi_source_thread_process_video2(ndi_source_config_t *config,
-				      NDIlib_video_frame_v2_t *ndi_video_frame,
-				      obs_source *obs_source,
-				      obs_source_frame *obs_video_frame)
-{
 	switch (ndi_video_frame->FourCC) {
 	case NDIlib_FourCC_type_BGRA:
 		obs_video_frame->format = VIDEO_FORMAT_BGRA;
@@ -892,17 +1227,79 @@ void ndi_source_thread_process_video2(ndi_source_config_t *config,
 		break;
 
 	case NDIlib_FourCC_type_UYVY:
-	case NDIlib_FourCC_type_UYVA:
 		obs_video_frame->format = VIDEO_FORMAT_UYVY;
 		break;
 
+	case NDIlib_FourCC_type_UYVA: {
+		// The alpha plane follows the UYVY lines and is used in place
+		const uint32_t chroma_width = (width + 1) / 2;
+		const size_t y_size = (size_t)width * height;
+		const size_t chroma_size = (size_t)chroma_width * height;
+		uint8_t *planes =
+			ndi_source_video_buffer(s, y_size + chroma_size * 2);
+		uint8_t *dst[3] = {planes, planes + y_size,
+				   planes + y_size + chroma_size};
+		const uint32_t dst_stride[3] = {width, chroma_width,
+						chroma_width};
+		ndi_convert_uyvy_to_planar(src, stride, dst, dst_stride, width,
+					   height);
+		obs_video_frame->format = VIDEO_FORMAT_I42A;
+		for (int i = 0; i < 3; i++) {
+			obs_video_frame->data[i] = dst[i];
+			obs_video_frame->linesize[i] = dst_stride[i];
+		}
+		obs_video_frame->data[3] = src + (size_t)stride * height;
+		obs_video_frame->linesize[3] = width;
+		break;
+	}
+
 	case NDIlib_FourCC_type_I420:
 		obs_video_frame->format = VIDEO_FORMAT_I420;
+		obs_video_frame->data[1] = src + (size_t)stride * height;
+		obs_video_frame->linesize[1] = stride / 2;
+		obs_video_frame->data[2] = obs_video_frame->data[1] +
+					   (size_t)(stride / 2) *
+						   ((height + 1) / 2);
+		obs_video_frame->linesize[2] = stride / 2;
 		break;
 
 	case NDIlib_FourCC_type_NV12:
 		obs_video_frame->format = VIDEO_FORMAT_NV12;
+		obs_video_frame->data[1] = src + (size_t)stride * height;
+		obs_video_frame->linesize[1] = stride;
+		break;
+
+	case NDIlib_FourCC_type_P216: {
+		// Luma is used in place, only chroma goes from 4:2:2 to 4:2:0
+		const uint32_t uv_stride = ((width + 1) & ~1u) * 2;
+		uint8_t *uv = ndi_source_video_buffer(
+			s, (size_t)uv_stride * ((height + 1) / 2));
+		ndi_convert_p216_to_p010_chroma(src + (size_t)stride * height,
+						stride, uv, uv_stride, width,
+						height);
+		obs_video_frame->format = VIDEO_FORMAT_P010;
+		obs_video_frame->data[1] = uv;
+		obs_video_frame->linesize[1] = uv_stride;
+		break;
+	}
+
+	case NDIlib_FourCC_type_PA16: {
+		const uint32_t plane_stride = width * 2;
+		const size_t plane_size = (size_t)plane_stride * height;
+		uint8_t *planes = ndi_source_video_buffer(s, plane_size * 4);
+		uint8_t *dst[4];
+		uint32_t dst_stride[4];
+		for (int i = 0; i < 4; i++) {
+			dst[i] = planes + plane_size * i;
+			dst_stride[i] = plane_stride;
+			obs_video_frame->data[i] = dst[i];
+			obs_video_frame->linesize[i] = plane_stride;
+		}
+		ndi_convert_pa16_to_ya2l(src, stride, dst, dst_stride, width,
+					 height);
+		obs_video_frame->format = VIDEO_FORMAT_YA2L;
 		break;
+	}
 
 	default:
 		blog(LOG_INFO,
@@ -921,43 +1318,915 @@ void ndi_source_thread_process_video2(ndi_source_config_t *config,
 		obs_video_frame->timestamp =
 			(uint64_t)(ndi_video_frame->timecode * 100);
 		break;
+
+	case PROP_SYNC_RECOVERED_CLOCK:
+		obs_video_frame->timestamp = ndi_source_recovered_time(
+			s, config, ndi_video_frame->timestamp,
+			ndi_video_frame->timecode);
+		break;
+	}
+
+	obs_video_frame->width = width;
+	obs_video_frame->height = height;
+
+	// Range and matrix depend on the bit depth of the format
+	video_format_get_parameters_for_format(
+		config->yuv_colorspace, config->yuv_range,
+		obs_video_frame->format, obs_video_frame->color_matrix,
+		obs_video_frame->color_range_min,
+		obs_video_frame->color_range_max);
+	obs_video_frame->trc = colorspace_to_trc(config->yuv_colorspace);
+
+	obs_source_output_video(s->obs_source, obs_video_frame);
+}
+
+static bool ndi_source_sync_config(void *data)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	ndi_source_config_t *config_snapshot = ndi_source_take_config(sub);
+	if (!config_snapshot)
+		return false;
+
+	// Most snapshots only carry tally or a new name. Output state is
+	// only thrown away for the settings it depends on, each reset costs
+	// a frame or an audio click.
+	const ndi_source_config_t *old_config = &sub->recv_config;
+	const bool fields_changed =
+		config_snapshot->fields.mode != old_config->fields.mode ||
+		config_snapshot->fields.order != old_config->fields.order ||
+		config_snapshot->fields.fallback != old_config->fields.fallback;
+	const bool audio_changed =
+		config_snapshot->sync_mode != old_config->sync_mode ||
+		config_snapshot->audio_drift_compensation !=
+			old_config->audio_drift_compensation ||
+		!ndi_audio_matrix_equals(&config_snapshot->audio_matrix,
+					 &old_config->audio_matrix);
+	const bool video_changed =
+		fields_changed || config_snapshot->scale != old_config->scale ||
+		config_snapshot->yuv_range != old_config->yuv_range ||
+		config_snapshot->yuv_colorspace != old_config->yuv_colorspace ||
+		config_snapshot->dedup_line_step != old_config->dedup_line_step;
+
+	sub->recv_config = *config_snapshot;
+	delete config_snapshot;
+
+	if (sub->live) {
+		auto s = sub->source;
+		pthread_mutex_lock(&s->output_mutex);
+		// A half woven frame may belong to another field setup
+		if (fields_changed)
+			ndi_fields_reset(&s->fields);
+		// Resampler history of other channels or another clock
+		if (audio_changed)
+			ndi_resampler_reset(&s->resampler);
+		// The same frame may come out differently now
+		if (video_changed)
+			ndi_dedup_reset(&s->dedup);
+		pthread_mutex_unlock(&s->output_mutex);
+	}
+	return true;
+}
+
+static void ndi_source_get_control(void *data, ndi_receiver_control_t *control)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	const ndi_source_config_t *config = &sub->recv_config;
+
+	// The first subscriber names the shared receiver
+	if (control->ndi_receiver_name.isEmpty())
+		control->ndi_receiver_name = config->ndi_receiver_name;
+
+	// Standbys don't show up on tally or move cameras
+	if (sub->standby)
+		return;
+
+	control->hw_accel_enabled |= config->hw_accel_enabled;
+
+	if (config->ptz.enabled && !control->ptz_enabled) {
+		control->ptz_enabled = true;
+		control->pan = config->ptz.pan;
+		control->tilt = config->ptz.tilt;
+		control->zoom = config->ptz.zoom;
+	}
+
+	control->tally.on_preview |= config->tally.on_preview;
+	control->tally.on_program |= config->tally.on_program;
+
+	if (config->stats_interval_ms &&
+	    (!control->stats_interval_ms ||
+	     config->stats_interval_ms < control->stats_interval_ms))
+		control->stats_interval_ms = config->stats_interval_ms;
+}
+
+static void ndi_source_output_video(void *data, NDIlib_video_frame_v2_t *frame)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	ndi_source_thread_process_video2(sub->source, &sub->recv_config,
+					 frame);
+}
+
+static void ndi_source_receive_video(void *data, NDIlib_video_frame_v2_t *frame,
+				     uint64_t capture_ns)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	auto s = sub->source;
+
+	sub->last_video_ns.store(os_gettime_ns(), std::memory_order_relaxed);
+
+	if (!sub->live) {
+		// Receiver still being brought up, see ndi_source_check_next
+		if (!sub->standby && !sub->ready.exchange(true))
+			ndi_task_wake(s->task);
+		return;
+	}
+
+	pthread_mutex_lock(&s->output_mutex);
+	if (!sub->live) {
+		pthread_mutex_unlock(&s->output_mutex);
+		return;
+	}
+
+	ndi_fields_process(&s->fields, &sub->recv_config.fields, frame,
+			   ndi_source_output_video, sub);
+
+	auto acc = &s->stats_accum;
+	uint64_t latency_ns = os_gettime_ns() - capture_ns;
+	acc->video_frames++;
+	acc->interval_video_frames++;
+	acc->latency_sum_ns += latency_ns;
+	if (latency_ns > acc->latency_max_ns)
+		acc->latency_max_ns = latency_ns;
+
+	// Smoothed deviation from the nominal frame interval (RFC 3550 style)
+	if (acc->last_capture_ns && frame->frame_rate_N > 0) {
+		double expected_ns = 1000000000.0 * frame->frame_rate_D /
+				     frame->frame_rate_N;
+		double deviation_ns =
+			fabs((double)(capture_ns - acc->last_capture_ns) -
+			     expected_ns);
+		acc->jitter_ns += (deviation_ns - acc->jitter_ns) / 16.0;
+	}
+	acc->last_capture_ns = capture_ns;
+
+	pthread_mutex_unlock(&s->output_mutex);
+}
+
+static void ndi_source_receive_audio(void *data, NDIlib_audio_frame_v3_t *frame)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	auto s = sub->source;
+
+	if (!sub->live && !sub->standby &&
+	    sub->key.bandwidth == NDIlib_recv_bandwidth_audio_only) {
+		// Audio only receiver being brought up, audio is all it
+		// delivers
+		if (!sub->ready.exchange(true))
+			ndi_task_wake(s->task);
+		return;
+	}
+
+	pthread_mutex_lock(&s->output_mutex);
+	if (sub->live) {
+		ndi_source_thread_process_audio3(s, &sub->recv_config, frame);
+		s->stats_accum.audio_frames++;
+	}
+	pthread_mutex_unlock(&s->output_mutex);
+}
+
+static void ndi_source_receive_metadata(void *data,
+					NDIlib_metadata_frame_t *frame)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	auto s = sub->source;
+
+	pthread_mutex_lock(&s->output_mutex);
+	if (sub->live)
+		ndi_metadata_queue_push(s->metadata, frame);
+	pthread_mutex_unlock(&s->output_mutex);
+}
+
+static void ndi_source_receive_stats(void *data,
+				     const ndi_receiver_stats_t *receiver_stats)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	auto s = sub->source;
+
+	pthread_mutex_lock(&s->output_mutex);
+	if (!sub->live) {
+		pthread_mutex_unlock(&s->output_mutex);
+		return;
 	}
 
-	obs_video_frame->width = ndi_video_frame->xres;
-	obs_video_frame->height = ndi_video_frame->yres;
-	obs_video_frame->linesize[0] = ndi_video_frame->line_stride_in_bytes;
-	obs_video_frame->data[0] = ndi_video_frame->p_data;
+	auto acc = &s->stats_accum;
+	ndi_source_stats_t stats = {};
+	stats.receiver = *receiver_stats;
+	stats.video_frames_output = acc->video_frames;
+	stats.audio_frames_output = acc->audio_frames;
+	stats.video_frames_repeated = acc->video_repeated;
+	if (acc->interval_video_checked) {
+		stats.repeated_ratio = (double)acc->interval_video_repeated /
+				       acc->interval_video_checked;
+	}
+	if (acc->interval_video_frames) {
+		stats.latency_avg_ms = (double)acc->latency_sum_ns /
+				       acc->interval_video_frames / 1000000.0;
+	}
+	stats.latency_max_ms = acc->latency_max_ns / 1000000.0;
+	stats.jitter_ms = acc->jitter_ns / 1000000.0;
+	stats.clock_drift_ppm = ndi_clock_drift_ppm(&s->clock);
+	stats.clock_relocks = s->clock.relocks;
+
+	acc->interval_video_frames = 0;
+	acc->interval_video_checked = 0;
+	acc->interval_video_repeated = 0;
+	acc->latency_sum_ns = 0;
+	acc->latency_max_ns = 0;
+	pthread_mutex_unlock(&s->output_mutex);
+
+	pthread_mutex_lock(&s->stats_mutex);
+	s->stats = stats;
+	pthread_mutex_unlock(&s->stats_mutex);
+
+	// Signal handlers may do anything, so not under the receiver's locks
+	if (sub->recv_config.stats_interval_ms) {
+		s->stats_pending = true;
+		ndi_task_wake(s->task);
+	}
+}
+
+static void ndi_source_signal_stats(ndi_source_t *s)
+{
+	ndi_source_stats_t stats;
+	ndi_source_get_stats(s, &stats);
+
+	calldata_t cd;
+	calldata_init(&cd);
+	calldata_set_ptr(&cd, "source", s->obs_source);
+	ndi_source_stats_to_calldata(&stats, &cd);
+	signal_handler_signal(obs_source_get_signal_handler(s->obs_source),
+			      "ndi_stats", &cd);
+	calldata_free(&cd);
+}
+
+static const ndi_receiver_callbacks_t ndi_source_receiver_callbacks = {
+	ndi_source_sync_config,      ndi_source_get_control,
+	ndi_source_receive_video,    ndi_source_receive_audio,
+	ndi_source_receive_metadata, ndi_source_receive_stats,
+};
+
+static NDIlib_recv_bandwidth_e prop_to_bandwidth(int bandwidth)
+{
+	switch (bandwidth) {
+	case PROP_BW_HIGHEST:
+	default:
+		return NDIlib_recv_bandwidth_highest;
+	case PROP_BW_LOWEST:
+		return NDIlib_recv_bandwidth_lowest;
+	case PROP_BW_AUDIO_ONLY:
+		return NDIlib_recv_bandwidth_audio_only;
+	}
+}
 
-	video_format_get_parameters(config->yuv_colorspace, config->yuv_range,
-				    obs_video_frame->color_matrix,
-				    obs_video_frame->color_range_min,
-				    obs_video_frame->color_range_max);
+static void ndi_source_get_receiver_key(ndi_source_t *s,
+					ndi_receiver_key_t *key)
+{
+	const ndi_source_config_t *config = &s->config;
+
+	key->ndi_source_name = s->active_source_name;
+
+	if (config->bandwidth == PROP_BW_AUTO)
+		key->bandwidth = s->auto_bandwidth;
+	else
+		key->bandwidth = prop_to_bandwidth(config->bandwidth);
+
+	// "best" is the only format that lets 16-bit P216/PA16 through
+	if (config->high_bit_depth)
+		key->color_format = NDIlib_recv_color_format_best;
+	else if (config->latency == PROP_LATENCY_NORMAL)
+		key->color_format = NDIlib_recv_color_format_UYVY_BGRA;
+	else
+		key->color_format = NDIlib_recv_color_format_fastest;
+
+	key->framesync_enabled = config->framesync_enabled;
+	key->framesync_pacing = config->framesync_enabled &&
+				config->framesync_pacing;
+	// "Lowest" bounds the delay instead of playing out a backlog. The
+	// framesync always hands out its newest frame anyway.
+	key->newest_video_only = config->latency == PROP_LATENCY_LOWEST &&
+				 !config->framesync_enabled;
+}
 
-	obs_source_output_video(obs_source, obs_video_frame);
+// Standbys only need to tell whether the NDI source delivers video and
+// have something to show the moment they take over
+static void ndi_source_get_standby_key(const QByteArray &ndi_source_name,
+				       ndi_receiver_key_t *key)
+{
+	key->ndi_source_name = ndi_source_name;
+	key->bandwidth = NDIlib_recv_bandwidth_lowest;
+	key->color_format = NDIlib_recv_color_format_fastest;
+	key->framesync_enabled = false;
+	key->framesync_pacing = false;
+	key->newest_video_only = false;
 }
 
-void ndi_source_thread_start(ndi_source_t *s)
+static ndi_source_subscription_t *
+ndi_source_subscribe(ndi_source_t *s, const ndi_receiver_key_t *key,
+		     enum ndi_source_subscription_role role)
 {
-	s->running = true;
-	pthread_create(&s->av_thread, nullptr, ndi_source_thread, s);
+	static const char *role_names[] = {"", ", staged", ", standby"};
+
+	auto sub = new ndi_source_subscription_t();
+	sub->source = s;
+	sub->key = *key;
+	sub->live = (role == NDI_SUBSCRIPTION_LIVE);
+	sub->standby = (role == NDI_SUBSCRIPTION_STANDBY);
+	sub->created_ns = os_gettime_ns();
+
+	// The receiver has no config of this source until it gets one
+	sub->pending_config = new ndi_source_config_t(s->config);
+	sub->receiver = ndi_receiver_subscribe(
+		key, &ndi_source_receiver_callbacks, sub);
 	blog(LOG_INFO,
-	     "[obs-ndi] ndi_source_thread_start: '%s' Started A/V ndi_source_thread for NDI source '%s'",
+	     "[obs-ndi] ndi_source_subscribe: '%s' Subscribed to receiver for NDI source '%s' (bandwidth=%d%s)",
 	     s->config.ndi_receiver_name.constData(),
-	     s->config.ndi_source_name.constData());
+	     key->ndi_source_name.constData(), key->bandwidth,
+	     role_names[role]);
+	return sub;
+}
+
+static void ndi_source_unsubscribe(ndi_source_subscription_t *sub)
+{
+	if (!sub)
+		return;
+
+	// No more callbacks for sub once this returns
+	ndi_receiver_unsubscribe(sub->receiver, sub);
+	delete sub->pending_config.exchange(nullptr);
+	delete sub;
+}
+
+static void *ndi_source_retire_thread(void *data)
+{
+	auto sub = (ndi_source_subscription_t *)data;
+	auto s = sub->source;
+
+	os_set_thread_name("ndi-retire");
+	ndi_source_unsubscribe(sub);
+
+	pthread_mutex_lock(&s->state_mutex);
+	s->retiring--;
+	pthread_cond_signal(&s->retired);
+	pthread_mutex_unlock(&s->state_mutex);
+	return nullptr;
+}
+
+// Unsubscribe sub on a thread of its own. Destroying an NDI receiver can
+// take a while and this is called from the graphics and UI threads, so
+// nothing reachable from there unsubscribes directly. Called with
+// state_mutex held.
+static void ndi_source_retire(ndi_source_t *s, ndi_source_subscription_t *sub)
+{
+	if (!sub)
+		return;
+
+	// Whatever frame the subscription is outputting finishes before
+	// this returns, e.g. ahead of a blank frame
+	pthread_mutex_lock(&s->output_mutex);
+	sub->live = false;
+	pthread_mutex_unlock(&s->output_mutex);
+
+	pthread_t thread;
+	if (pthread_create(&thread, nullptr, ndi_source_retire_thread, sub) !=
+	    0) {
+		ndi_source_unsubscribe(sub);
+		return;
+	}
+	pthread_detach(thread);
+	s->retiring++;
+}
+
+static bool bandwidth_has_video(NDIlib_recv_bandwidth_e bandwidth)
+{
+	return bandwidth == NDIlib_recv_bandwidth_highest ||
+	       bandwidth == NDIlib_recv_bandwidth_lowest;
+}
+
+static void ndi_source_output_blank(ndi_source_t *s)
+{
+	// The next frame replaces the blank one even if it repeats the last
+	pthread_mutex_lock(&s->output_mutex);
+	ndi_dedup_reset(&s->dedup);
+	pthread_mutex_unlock(&s->output_mutex);
+
+	if (s->gpu_video)
+		ndi_gpu_video_clear(s->gpu_video);
+	else
+		obs_source_output_video(s->obs_source, s->config.blank_frame);
+}
+
+// Make the staged subscription the one feeding OBS
+static void ndi_source_promote_next(ndi_source_t *s)
+{
+	ndi_source_subscription_t *old = s->subscription;
+	ndi_source_subscription_t *next = s->next_subscription;
+
+	pthread_mutex_lock(&s->output_mutex);
+	if (old)
+		old->live = false;
+	next->live = true;
+	ndi_fields_reset(&s->fields);
+	ndi_clock_reset(&s->clock);
+	ndi_resampler_reset(&s->resampler);
+	ndi_dedup_reset(&s->dedup);
+	pthread_mutex_unlock(&s->output_mutex);
+
+	s->subscription = next;
+	s->next_subscription = nullptr;
+	blog(LOG_INFO,
+	     "[obs-ndi] ndi_source_promote_next: '%s' Switched to receiver with bandwidth=%d",
+	     s->config.ndi_receiver_name.constData(), next->key.bandwidth);
+
+	ndi_source_retire(s, old);
+
+	// The last frame of the old receiver would stay up forever
+	if (next->key.bandwidth == NDIlib_recv_bandwidth_audio_only)
+		ndi_source_output_blank(s);
+}
+
+// Promote the staged subscription once it delivers, or once an audio only
+// one had its time: senders without audio never deliver any. Returns when
+// to check again. Called with state_mutex held.
+static uint64_t ndi_source_check_next(ndi_source_t *s)
+{
+	ndi_source_subscription_t *next = s->next_subscription;
+	if (!next)
+		return NDI_TASK_SLEEP;
+
+	if (next->ready) {
+		ndi_source_promote_next(s);
+		return NDI_TASK_SLEEP;
+	}
+
+	if (next->key.bandwidth != NDIlib_recv_bandwidth_audio_only)
+		return NDI_TASK_SLEEP;
+
+	const uint64_t due_ns =
+		next->created_ns + NDI_SOURCE_AUDIO_STAGE_TIMEOUT_NS;
+	if (os_gettime_ns() < due_ns)
+		return due_ns;
+
+	ndi_source_promote_next(s);
+	return NDI_TASK_SLEEP;
+}
+
+// Primary NDI source first, then the backups in order of preference
+static int ndi_source_name_count(const ndi_source_config_t *config)
+{
+	return 1 + (int)config->backup_source_names.size();
+}
+
+static const QByteArray &ndi_source_name_at(const ndi_source_config_t *config,
+					    int index)
+{
+	return index ? config->backup_source_names[index - 1]
+		     : config->ndi_source_name;
+}
+
+static int ndi_source_active_index(ndi_source_t *s)
+{
+	for (int i = 0; i < ndi_source_name_count(&s->config); i++) {
+		if (ndi_source_name_at(&s->config, i) == s->active_source_name)
+			return i;
+	}
+	return 0;
 }
 
-void ndi_source_thread_stop(ndi_source_t *s)
+// Keep a standby subscription on every NDI source the source could fail
+// over to. Called with state_mutex held.
+static void ndi_source_sync_standby(ndi_source_t *s)
 {
-	if (s->running) {
-		s->running = false;
-		pthread_join(s->av_thread, NULL);
-		if (!s->config.remember_last_frame) {
-			obs_source_output_video(s->obs_source,
-						s->config.blank_frame);
+	const ndi_source_config_t *config = &s->config;
+	const int count = ndi_source_name_count(config);
+
+	ndi_receiver_key_t key;
+	ndi_source_get_receiver_key(s, &key);
+	const bool wanted = s->subscription && count > 1 &&
+			    bandwidth_has_video(key.bandwidth);
+
+	for (int i = 0; i <= NDI_SOURCE_MAX_BACKUPS; i++) {
+		const bool want =
+			wanted && i < count &&
+			ndi_source_name_at(config, i) != s->active_source_name;
+
+		ndi_source_subscription_t *sub = s->standby[i];
+		if (sub && (!want || sub->key.ndi_source_name !=
+					     ndi_source_name_at(config, i))) {
+			ndi_source_retire(s, sub);
+			s->standby[i] = sub = nullptr;
+		}
+
+		if (!sub && want) {
+			ndi_source_get_standby_key(ndi_source_name_at(config, i),
+						   &key);
+			s->standby[i] = ndi_source_subscribe(
+				s, &key, NDI_SUBSCRIPTION_STANDBY);
 		}
 	}
 }
 
+static void ndi_source_switch_receiver(ndi_source_t *s, bool staged)
+{
+	ndi_receiver_key_t key;
+	ndi_source_get_receiver_key(s, &key);
+
+	if (s->subscription &&
+	    ndi_receiver_key_equals(&key, &s->subscription->key)) {
+		// Back where we were before a switch got staged
+		ndi_source_retire(s, s->next_subscription);
+		s->next_subscription = nullptr;
+		return;
+	}
+
+	if (s->next_subscription &&
+	    ndi_receiver_key_equals(&key, &s->next_subscription->key))
+		return;
+
+	ndi_source_retire(s, s->next_subscription);
+	s->next_subscription = nullptr;
+
+	// Make before break: keep the current receiver feeding OBS until
+	// the new one delivers what it is for, video or audio only. Metadata
+	// only never delivers either, and without a receiver to keep there
+	// is nothing to wait for: switch right away. The old receiver goes
+	// away in the background either way.
+	if (staged && s->subscription &&
+	    key.bandwidth != NDIlib_recv_bandwidth_metadata_only) {
+		s->next_subscription =
+			ndi_source_subscribe(s, &key, NDI_SUBSCRIPTION_STAGED);
+		// Promoted by the task, which may not know about it yet
+		ndi_task_wake(s->task);
+		return;
+	}
+
+	ndi_source_retire(s, s->subscription);
+	s->subscription = nullptr;
+
+	if (key.bandwidth == NDIlib_recv_bandwidth_audio_only)
+		ndi_source_output_blank(s);
+
+	// Possibly another sender, with a clock of its own
+	pthread_mutex_lock(&s->output_mutex);
+	ndi_clock_reset(&s->clock);
+	ndi_resampler_reset(&s->resampler);
+	ndi_dedup_reset(&s->dedup);
+	pthread_mutex_unlock(&s->output_mutex);
+
+	s->subscription = ndi_source_subscribe(s, &key, NDI_SUBSCRIPTION_LIVE);
+}
+
+// Subscribe to the shared receiver matching the current config, moving
+// over from the previous one if the connection parameters changed.
+// Called with state_mutex held.
+void ndi_source_receiver_start(ndi_source_t *s, bool staged)
+{
+	ndi_source_switch_receiver(s, staged);
+	ndi_source_sync_standby(s);
+}
+
+// Called with state_mutex held, from ndi_source_task when the source
+// gets deactivated
+void ndi_source_receiver_stop(ndi_source_t *s)
+{
+	ndi_source_retire(s, s->next_subscription);
+	s->next_subscription = nullptr;
+
+	if (s->subscription) {
+		ndi_source_retire(s, s->subscription);
+		s->subscription = nullptr;
+		if (!s->config.remember_last_frame)
+			ndi_source_output_blank(s);
+	}
+
+	ndi_source_sync_standby(s);
+}
+
+// Move to the most preferred NDI source delivering video when the current
+// one stopped for longer than the failover timeout, and back to a more
+// preferred one once it delivers again. Returns when to check again.
+// Called with state_mutex held.
+static uint64_t ndi_source_check_failover(ndi_source_t *s)
+{
+	const ndi_source_config_t *config = &s->config;
+	const int count = ndi_source_name_count(config);
+	ndi_source_subscription_t *current = s->subscription;
+	if (count < 2 || !current || !bandwidth_has_video(current->key.bandwidth))
+		return NDI_TASK_SLEEP;
+
+	const uint64_t now = os_gettime_ns();
+	const uint64_t timeout_ns = config->failover_timeout_ms * 1000000ULL;
+	const uint64_t poll_ns = now + timeout_ns / NDI_SOURCE_FAILOVER_POLLS;
+
+	for (int i = 0; i < count; i++) {
+		ndi_source_subscription_t *sub = s->standby[i];
+		if (!sub)
+			continue;
+		uint64_t last_video_ns = sub->last_video_ns;
+		if (!last_video_ns || now - last_video_ns >= timeout_ns)
+			sub->healthy_since_ns = 0;
+		else if (!sub->healthy_since_ns)
+			sub->healthy_since_ns = now;
+	}
+
+	// A new subscription gets the timeout to deliver its first frame
+	const uint64_t current_due_ns =
+		std::max(current->last_video_ns.load(), current->created_ns) +
+		timeout_ns;
+	const bool current_ok = now < current_due_ns;
+	const int active = ndi_source_active_index(s);
+
+	int target = -1;
+	for (int i = 0; i < count && target < 0; i++) {
+		ndi_source_subscription_t *sub = s->standby[i];
+		if (!sub || !sub->healthy_since_ns)
+			continue;
+		if (!current_ok ||
+		    (i < active &&
+		     now - sub->healthy_since_ns >= NDI_SOURCE_FAILBACK_HOLD_NS))
+			target = i;
+	}
+	if (target < 0) {
+		// Standbys only matter once the current one is late, or to
+		// fail back to
+		if (!current_ok)
+			return poll_ns;
+		if (active > 0)
+			return std::min(current_due_ns, poll_ns);
+		return current_due_ns;
+	}
+
+	ndi_source_subscription_t *standby = s->standby[target];
+	s->standby[target] = nullptr;
+
+	blog(current_ok ? LOG_INFO : LOG_WARNING,
+	     "[obs-ndi] ndi_source_check_failover: '%s' %s from NDI source '%s' to '%s'",
+	     s->config.ndi_receiver_name.constData(),
+	     current_ok ? "Failing back" : "Failing over",
+	     s->active_source_name.constData(),
+	     standby->key.ndi_source_name.constData());
+	s->active_source_name = standby->key.ndi_source_name;
+
+	if (current_ok) {
+		// Nothing urgent, switch make-before-break at full bandwidth
+		ndi_source_retire(s, standby);
+		ndi_source_receiver_start(s, true);
+		return poll_ns;
+	}
+
+	// The standby already delivers video, so it takes over right away
+	// at its lower bandwidth until the full receiver is up
+	ndi_source_retire(s, s->next_subscription);
+	standby->standby = false;
+	s->next_subscription = standby;
+	ndi_source_promote_next(s);
+	ndi_source_receiver_start(s, true);
+	return poll_ns;
+}
+
+// Bumped whenever scene items come or go anywhere, so that sources in
+// "Automatic" bandwidth mode only look for themselves in the scenes after
+// a change instead of on every check
+static std::atomic<uint64_t> scene_items_generation = 1;
+
+static void ndi_source_scene_items_changed(void *, calldata_t *)
+{
+	scene_items_generation++;
+}
+
+static void ndi_source_watch_scene(obs_source_t *scene_source)
+{
+	signal_handler_t *sh = obs_source_get_signal_handler(scene_source);
+	signal_handler_connect(sh, "item_add", ndi_source_scene_items_changed,
+			       nullptr);
+	signal_handler_connect(sh, "item_remove",
+			       ndi_source_scene_items_changed, nullptr);
+}
+
+static void ndi_source_scene_created(void *, calldata_t *cd)
+{
+	auto source = (obs_source_t *)calldata_ptr(cd, "source");
+	if (source && obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE)
+		ndi_source_watch_scene(source);
+}
+
+// Scenes only go away with their items, which counts as a change too
+static void ndi_source_scene_removed(void *, calldata_t *cd)
+{
+	auto source = (obs_source_t *)calldata_ptr(cd, "source");
+	if (source && obs_source_get_type(source) == OBS_SOURCE_TYPE_SCENE)
+		scene_items_generation++;
+}
+
+void ndi_source_scene_tracking_start()
+{
+	signal_handler_t *sh = obs_get_signal_handler();
+	signal_handler_connect(sh, "source_create", ndi_source_scene_created,
+			       nullptr);
+	signal_handler_connect(sh, "source_remove", ndi_source_scene_removed,
+			       nullptr);
+
+	// Normally none yet, scenes are loaded after the modules
+	obs_enum_scenes(
+		[](void *, obs_source_t *scene_source) {
+			ndi_source_watch_scene(scene_source);
+			return true;
+		},
+		nullptr);
+}
+
+void ndi_source_scene_tracking_stop()
+{
+	signal_handler_t *sh = obs_get_signal_handler();
+	signal_handler_disconnect(sh, "source_create",
+				  ndi_source_scene_created, nullptr);
+	signal_handler_disconnect(sh, "source_remove",
+				  ndi_source_scene_removed, nullptr);
+}
+
+static bool ndi_source_in_any_scene(ndi_source_t *s)
+{
+	const uint64_t generation = scene_items_generation;
+	if (generation == s->scene_items_generation)
+		return s->in_any_scene;
+	s->scene_items_generation = generation;
+
+	typedef struct {
+		const char *name;
+		bool found;
+	} search_context_t;
+
+	search_context_t search = {obs_source_get_name(s->obs_source), false};
+	obs_enum_scenes(
+		[](void *param, obs_source_t *scene_source) {
+			auto ctx = (search_context_t *)param;
+			obs_scene_t *scene = obs_scene_from_source(scene_source);
+			if (scene &&
+			    obs_scene_find_source_recursive(scene, ctx->name))
+				ctx->found = true;
+			return !ctx->found;
+		},
+		&search);
+	s->in_any_scene = search.found;
+	return s->in_any_scene;
+}
+
+// Order of the bandwidths in terms of what they deliver
+static int bandwidth_rank(NDIlib_recv_bandwidth_e bandwidth)
+{
+	switch (bandwidth) {
+	case NDIlib_recv_bandwidth_metadata_only:
+		return 0;
+	case NDIlib_recv_bandwidth_audio_only:
+		return 1;
+	case NDIlib_recv_bandwidth_lowest:
+		return 2;
+	default:
+		return 3;
+	}
+}
+
+static NDIlib_recv_bandwidth_e ndi_source_auto_bandwidth_target(ndi_source_t *s)
+{
+	// Brought up to date either way, the task checks it for changes
+	const bool in_any_scene = ndi_source_in_any_scene(s);
+
+	// There is no separate warm standby: a source in preview is showing
+	// and so already runs at highest, and taking it to program keeps
+	// that receiver. Only a source going live without being previewed
+	// first switches up, make-before-break, with the lowest receiver
+	// showing frames until the highest one delivers.
+	if (obs_source_active(s->obs_source) ||
+	    obs_source_showing(s->obs_source))
+		return NDIlib_recv_bandwidth_highest;
+	if (in_any_scene)
+		return NDIlib_recv_bandwidth_lowest;
+	return NDIlib_recv_bandwidth_metadata_only;
+}
+
+// Follow the visibility of the source in "Automatic" bandwidth mode, from
+// ndi_source_task after show/hide/activate/deactivate and when scene items
+// change.
+// Going up happens right away, going down only once the source stayed in
+// its new state for NDI_SOURCE_AUTO_BW_HOLD_NS, so that quick scene flips
+// don't recreate receivers. Called with state_mutex held.
+static void ndi_source_update_auto_bandwidth(ndi_source_t *s)
+{
+	if (s->config.bandwidth != PROP_BW_AUTO)
+		return;
+
+	uint64_t now = os_gettime_ns();
+	NDIlib_recv_bandwidth_e target = ndi_source_auto_bandwidth_target(s);
+
+	if (target == s->auto_bandwidth) {
+		s->auto_bandwidth_pending = false;
+		return;
+	}
+
+	if (bandwidth_rank(target) < bandwidth_rank(s->auto_bandwidth)) {
+		if (!s->auto_bandwidth_pending ||
+		    s->auto_bandwidth_pending_target != target) {
+			s->auto_bandwidth_pending = true;
+			s->auto_bandwidth_pending_target = target;
+			s->auto_bandwidth_pending_since_ns = now;
+		}
+		if (now - s->auto_bandwidth_pending_since_ns <
+		    NDI_SOURCE_AUTO_BW_HOLD_NS)
+			return;
+	}
+
+	s->auto_bandwidth_pending = false;
+	s->auto_bandwidth = target;
+	if (s->subscription)
+		ndi_source_receiver_start(s, true);
+}
+
+// Bring tally, the receiver and automatic bandwidth in line with where
+// the source is shown, after show/hide/activate/deactivate. Called with
+// state_mutex held.
+static void ndi_source_sync_visibility(ndi_source_t *s)
+{
+	const bool showing = obs_source_showing(s->obs_source);
+	const bool active = obs_source_active(s->obs_source);
+
+	Config *conf = Config::Current();
+	NDIlib_tally_t tally = {};
+	tally.on_preview = conf->TallyPreviewEnabled && showing;
+	tally.on_program = conf->TallyProgramEnabled && active;
+	if (tally.on_preview != s->config.tally.on_preview ||
+	    tally.on_program != s->config.tally.on_program) {
+		s->config.tally = tally;
+		ndi_source_publish_config(s);
+	}
+
+	if (showing)
+		ptz_presets_set_source_ndiname_map(
+			s->obs_source, s->config.ndi_source_name.data());
+
+	if (!active && s->config.behavior == BEHAVIOR_DISCONNECT &&
+	    s->subscription) {
+		ndi_source_receiver_stop(s);
+		return;
+	}
+
+	ndi_source_update_auto_bandwidth(s);
+
+	if (active && !s->subscription && !s->config.ndi_source_name.isEmpty())
+		ndi_source_receiver_start(s, false);
+}
+
+// Receiver switches on behalf of the graphics thread and the receivers.
+// Subscribing and switching take locks that receiver tasks hold while
+// they convert and output frames, so show/hide/activate/deactivate,
+// video_tick and a staged receiver delivering its first frame only wake
+// this task. Otherwise it sleeps, or waits out a pending bandwidth change,
+// audio only stage or failover check. Stats samples are signaled from
+// here too, once no lock is held.
+static uint64_t ndi_source_task(void *data)
+{
+	auto s = (ndi_source_t *)data;
+
+	pthread_mutex_lock(&s->state_mutex);
+	if (s->stopping) {
+		pthread_mutex_unlock(&s->state_mutex);
+		return NDI_TASK_DONE;
+	}
+
+	if (s->visibility_changed.exchange(false))
+		ndi_source_sync_visibility(s);
+	else if (s->config.bandwidth == PROP_BW_AUTO &&
+		 (s->auto_bandwidth_pending ||
+		  s->scene_items_generation != scene_items_generation))
+		ndi_source_update_auto_bandwidth(s);
+
+	uint64_t next_ns = ndi_source_check_next(s);
+	next_ns = std::min(next_ns, ndi_source_check_failover(s));
+	if (s->config.bandwidth == PROP_BW_AUTO && s->auto_bandwidth_pending) {
+		uint64_t hold_ns = s->auto_bandwidth_pending_since_ns +
+				   NDI_SOURCE_AUTO_BW_HOLD_NS;
+		next_ns = std::min(next_ns, hold_ns);
+	}
+	pthread_mutex_unlock(&s->state_mutex);
+
+	if (s->stats_pending.exchange(false))
+		ndi_source_signal_stats(s);
+	return next_ns;
+}
+
+static void ndi_source_visibility_changed(ndi_source_t *s)
+{
+	s->visibility_changed = true;
+	ndi_task_wake(s->task);
+}
+
 void ndi_source_update(void *data, obs_data_t *settings)
 {
 	auto s = (ndi_source_t *)data;
@@ -965,9 +2234,29 @@ void ndi_source_update(void *data, obs_data_t *settings)
 	auto name = obs_source_get_name(obs_source);
 	blog(LOG_INFO, "[obs-ndi] +ndi_source_update('%s'...)", name);
 
+	pthread_mutex_lock(&s->state_mutex);
+
 	ndi_source_config_t config = s->config;
 
 	config.ndi_source_name = obs_data_get_string(settings, PROP_SOURCE);
+
+	config.backup_source_names.clear();
+	obs_data_array_t *backups =
+		obs_data_get_array(settings, PROP_BACKUP_SOURCES);
+	size_t backup_count = obs_data_array_count(backups);
+	for (size_t i = 0; i < backup_count &&
+			   config.backup_source_names.size() <
+				   NDI_SOURCE_MAX_BACKUPS;
+	     i++) {
+		obs_data_t *item = obs_data_array_item(backups, i);
+		const char *backup = obs_data_get_string(item, "value");
+		if (*backup)
+			config.backup_source_names.append(backup);
+		obs_data_release(item);
+	}
+	obs_data_array_release(backups);
+	config.failover_timeout_ms =
+		(uint32_t)obs_data_get_int(settings, PROP_FAILOVER_TIMEOUT);
 	config.bandwidth = (int)obs_data_get_int(settings, PROP_BANDWIDTH);
 	ptz_presets_set_source_ndiname_map(obs_source,
 					   config.ndi_source_name.data());
@@ -990,10 +2279,15 @@ void ndi_source_update(void *data, obs_data_t *settings)
 		obs_data_set_int(settings, PROP_SYNC,
 				 PROP_SYNC_NDI_SOURCE_TIMECODE);
 	}
+	config.sync_delay_ms =
+		(uint32_t)obs_data_get_int(settings, PROP_SYNC_DELAY);
 
 	config.framesync_enabled = obs_data_get_bool(settings, PROP_FRAMESYNC);
+	config.framesync_pacing =
+		obs_data_get_bool(settings, PROP_FRAMESYNC_PACING);
 
 	config.hw_accel_enabled = obs_data_get_bool(settings, PROP_HW_ACCEL);
+	config.high_bit_depth = obs_data_get_bool(settings, PROP_HIGH_BIT_DEPTH);
 
 	bool alpha_filter_enabled = obs_data_get_bool(settings, PROP_FIX_ALPHA);
 	// Prevent duplicate filters by not persisting this value in settings
@@ -1022,7 +2316,29 @@ void ndi_source_update(void *data, obs_data_t *settings)
 	const bool is_unbuffered = (config.latency == PROP_LATENCY_LOWEST);
 	obs_source_set_async_unbuffered(obs_source, is_unbuffered);
 
+	config.scale = (ndi_scale_factor)obs_data_get_int(settings, PROP_SCALE);
+	config.dedup_line_step =
+		(uint32_t)obs_data_get_int(settings, PROP_DEDUP);
+
+	config.fields.mode =
+		(ndi_fields_mode)obs_data_get_int(settings, PROP_FIELD_MODE);
+	config.fields.order =
+		(ndi_fields_order)obs_data_get_int(settings, PROP_FIELD_ORDER);
+	config.fields.fallback = (ndi_fields_fallback)obs_data_get_int(
+		settings, PROP_FIELD_FALLBACK);
+
 	config.audio_enabled = obs_data_get_bool(settings, PROP_AUDIO);
+	const char *audio_routing =
+		obs_data_get_string(settings, PROP_AUDIO_ROUTING);
+	if (!ndi_audio_matrix_parse(audio_routing, &config.audio_matrix)) {
+		blog(LOG_WARNING,
+		     "[obs-ndi] ndi_source_update: '%s' Invalid audio channel routing '%s', passing channels through",
+		     name, audio_routing);
+	}
+	config.audio_drift_compensation =
+		obs_data_get_bool(settings, PROP_AUDIO_DRIFT);
+	config.stats_interval_ms =
+		(uint32_t)obs_data_get_int(settings, PROP_STATS_INTERVAL);
 	obs_source_set_audio_active(obs_source, config.audio_enabled);
 
 	bool ptz_enabled = obs_data_get_bool(settings, PROP_PTZ);
@@ -1039,16 +2355,37 @@ void ndi_source_update(void *data, obs_data_t *settings)
 				  obs_source_active(obs_source);
 
 	s->config = config;
+	ndi_source_publish_config(s);
+
+	// Stay on a backup that is still listed
+	bool active_listed = false;
+	for (int i = 0; i < ndi_source_name_count(&s->config); i++) {
+		if (ndi_source_name_at(&s->config, i) == s->active_source_name)
+			active_listed = true;
+	}
+	if (!active_listed)
+		s->active_source_name = config.ndi_source_name;
+
+	if (config.bandwidth == PROP_BW_AUTO) {
+		// Settings changes don't wait for the hold time
+		s->auto_bandwidth = ndi_source_auto_bandwidth_target(s);
+		s->auto_bandwidth_pending = false;
+	}
 
 	if (!config.ndi_source_name.isEmpty()) {
-		if (!s->running && (config.behavior == BEHAVIOR_KEEP ||
-				    obs_source_active(obs_source))) {
-			ndi_source_thread_start(s);
+		if (s->subscription || config.behavior == BEHAVIOR_KEEP ||
+		    obs_source_active(obs_source)) {
+			ndi_source_receiver_start(s, true);
 		}
 	} else {
-		ndi_source_thread_stop(s);
+		ndi_source_receiver_stop(s);
 	}
 
+	pthread_mutex_unlock(&s->state_mutex);
+
+	// Failover checks follow the new receivers and timeout
+	ndi_task_wake(s->task);
+
 	blog(LOG_INFO, "[obs-ndi] -ndi_source_update('%s'...)", name);
 }
 
@@ -1057,9 +2394,7 @@ void ndi_source_shown(void *data)
 	auto s = (ndi_source_t *)data;
 	auto name = obs_source_get_name(s->obs_source);
 	blog(LOG_INFO, "[obs-ndi] ndi_source_shown('%s'...)", name);
-	s->config.tally.on_preview = (Config::Current())->TallyPreviewEnabled;
-
-	ptz_presets_set_source_ndiname_map(s->obs_source, s->config.ndi_source_name.data());
+	ndi_source_visibility_changed(s);
 }
 
 void ndi_source_hidden(void *data)
@@ -1067,7 +2402,7 @@ void ndi_source_hidden(void *data)
 	auto s = (ndi_source_t *)data;
 	auto name = obs_source_get_name(s->obs_source);
 	blog(LOG_INFO, "[obs-ndi] ndi_source_hidden('%s'...)", name);
-	s->config.tally.on_preview = false;
+	ndi_source_visibility_changed(s);
 }
 
 void ndi_source_activated(void *data)
@@ -1075,11 +2410,7 @@ void ndi_source_activated(void *data)
 	auto s = (ndi_source_t *)data;
 	auto name = obs_source_get_name(s->obs_source);
 	blog(LOG_INFO, "[obs-ndi] ndi_source_activated('%s'...)", name);
-	s->config.tally.on_program = (Config::Current())->TallyProgramEnabled;
-
-	if (!s->running) {
-		ndi_source_thread_start(s);
-	}
+	ndi_source_visibility_changed(s);
 }
 
 void ndi_source_deactivated(void *data)
@@ -1087,10 +2418,18 @@ void ndi_source_deactivated(void *data)
 	auto s = (ndi_source_t *)data;
 	auto name = obs_source_get_name(s->obs_source);
 	blog(LOG_INFO, "[obs-ndi] ndi_source_deactivated('%s'...)", name);
-	s->config.tally.on_program = false;
+	ndi_source_visibility_changed(s);
+}
+
+void ndi_source_video_tick(void *data, float)
+{
+	auto s = (ndi_source_t *)data;
 
-	if (s->config.behavior == BEHAVIOR_DISCONNECT && s->running) {
-		ndi_source_thread_stop(s);
+	// Scene items came or went, the task looks for the source again
+	const uint64_t generation = scene_items_generation;
+	if (s->tick_scene_items_generation != generation) {
+		s->tick_scene_items_generation = generation;
+		ndi_task_wake(s->task);
 	}
 }
 
@@ -1099,25 +2438,72 @@ void ndi_source_renamed(void *data, calldata_t *)
 	auto s = (ndi_source_t *)data;
 	auto name = obs_source_get_name(s->obs_source);
 	blog(LOG_INFO, "[obs-ndi] ndi_source_renamed: name='%s'", name);
+	pthread_mutex_lock(&s->state_mutex);
 	s->config.ndi_receiver_name =
 		QString("OBS-NDI '%1'").arg(name).toUtf8();
+	ndi_source_publish_config(s);
+	pthread_mutex_unlock(&s->state_mutex);
 }
 
-void *ndi_source_create(obs_data_t *settings, obs_source_t *obs_source)
+void ndi_source_video_render(void *data, gs_effect_t *)
+{
+	auto s = (ndi_source_t *)data;
+	ndi_gpu_video_render(s->gpu_video);
+}
+
+uint32_t ndi_source_get_width(void *data)
+{
+	auto s = (ndi_source_t *)data;
+	return ndi_gpu_video_get_width(s->gpu_video);
+}
+
+uint32_t ndi_source_get_height(void *data)
+{
+	auto s = (ndi_source_t *)data;
+	return ndi_gpu_video_get_height(s->gpu_video);
+}
+
+static void *ndi_source_create_variant(obs_data_t *settings,
+				       obs_source_t *obs_source,
+				       bool gpu_upload)
 {
 	auto name = obs_source_get_name(obs_source);
 	blog(LOG_INFO, "[obs-ndi] +ndi_source_create('%s'...)", name);
 
-	auto s = (ndi_source_t *)bzalloc(sizeof(ndi_source_t));
+	auto s = new ndi_source_t();
 	s->obs_source = obs_source;
+	if (gpu_upload)
+		s->gpu_video = ndi_gpu_video_create();
 	s->config.ndi_receiver_name =
 		QString("OBS-NDI '%1'").arg(name).toUtf8();
 
 	// Allocate blank video frame
 	s->config.blank_frame = blank_video_frame();
 
+	pthread_mutex_init(&s->state_mutex, nullptr);
+	pthread_cond_init(&s->retired, nullptr);
+	pthread_mutex_init(&s->output_mutex, nullptr);
+	pthread_mutex_init(&s->stats_mutex, nullptr);
+	ndi_clock_reset(&s->clock);
+
+	s->metadata = ndi_metadata_queue_create(s->obs_source);
+	s->scaler = ndi_scaler_create();
+	s->task = ndi_task_start(ndi_source_task, s);
+
 	auto sh = obs_source_get_signal_handler(s->obs_source);
 	signal_handler_connect(sh, "rename", ndi_source_renamed, s);
+	signal_handler_add(sh, "void ndi_stats(ptr source, " NDI_SOURCE_STATS_PARAMS(
+				       "") ")");
+
+	auto ph = obs_source_get_proc_handler(s->obs_source);
+	proc_handler_add(ph,
+			 "void get_ndi_stats(" NDI_SOURCE_STATS_PARAMS(
+				 "out ") ")",
+			 ndi_source_proc_get_stats, s);
+	proc_handler_add(
+		ph,
+		"void get_ndi_metadata(in string element, out bool found, out string data, out int timecode)",
+		ndi_source_proc_get_metadata, s);
 
 	ndi_source_update(s, settings);
 
@@ -1126,6 +2512,16 @@ void *ndi_source_create(obs_data_t *settings, obs_source_t *obs_source)
 	return s;
 }
 
+void *ndi_source_create(obs_data_t *settings, obs_source_t *obs_source)
+{
+	return ndi_source_create_variant(settings, obs_source, false);
+}
+
+void *ndi_source_gpu_create(obs_data_t *settings, obs_source_t *obs_source)
+{
+	return ndi_source_create_variant(settings, obs_source, true);
+}
+
 void ndi_source_destroy(void *data)
 {
 	auto s = (ndi_source_t *)data;
@@ -1137,11 +2533,33 @@ void ndi_source_destroy(void *data)
 	signal_handler_disconnect(obs_source_get_signal_handler(s->obs_source),
 				  "rename", ndi_source_renamed, s);
 
-	ndi_source_thread_stop(s);
-
+	pthread_mutex_lock(&s->state_mutex);
+	s->stopping = true;
+	ndi_source_receiver_stop(s);
+	// Retired subscriptions still point at s
+	while (s->retiring > 0)
+		pthread_cond_wait(&s->retired, &s->state_mutex);
+	pthread_mutex_unlock(&s->state_mutex);
+
+	// Nothing is left to wake the task but us
+	ndi_task_wake(s->task);
+	ndi_task_join(s->task);
+
+	ndi_metadata_queue_destroy(s->metadata);
+	// Gives back the frame it still holds
+	ndi_gpu_video_destroy(s->gpu_video);
 	obs_source_frame_destroy(s->config.blank_frame);
-
-	bfree(s);
+	bfree(s->video_buffer);
+	bfree(s->audio_buffer);
+	ndi_fields_free(&s->fields);
+	ndi_scaler_destroy(s->scaler);
+	ndi_resampler_free(&s->resampler);
+	pthread_mutex_destroy(&s->stats_mutex);
+	pthread_mutex_destroy(&s->output_mutex);
+	pthread_cond_destroy(&s->retired);
+	pthread_mutex_destroy(&s->state_mutex);
+
+	delete s;
 
 	blog(LOG_INFO, "[obs-ndi] -ndi_source_destroy('%s'...)", name);
 }
@@ -1165,7 +2583,29 @@ obs_source_info create_ndi_source_info()
 	ndi_source_info.update = ndi_source_update;
 	ndi_source_info.hide = ndi_source_hidden;
 	ndi_source_info.deactivate = ndi_source_deactivated;
+	ndi_source_info.video_tick = ndi_source_video_tick;
 	ndi_source_info.destroy = ndi_source_destroy;
 
 	return ndi_source_info;
 }
+
+// Same source drawn synchronously: the latest frame stays in NDI's buffer
+// until video_render uploads it, skipping the async frame cache and its
+// per-frame copies
+obs_source_info create_ndi_gpu_source_info()
+{
+	obs_source_info ndi_gpu_source_info = create_ndi_source_info();
+	ndi_gpu_source_info.id = "ndi_source_gpu";
+	ndi_gpu_source_info.output_flags = OBS_SOURCE_VIDEO |
+					   OBS_SOURCE_CUSTOM_DRAW |
+					   OBS_SOURCE_AUDIO |
+					   OBS_SOURCE_DO_NOT_DUPLICATE;
+
+	ndi_gpu_source_info.get_name = ndi_source_gpu_getname;
+	ndi_gpu_source_info.create = ndi_source_gpu_create;
+	ndi_gpu_source_info.video_render = ndi_source_video_render;
+	ndi_gpu_source_info.get_width = ndi_source_get_width;
+	ndi_gpu_source_info.get_height = ndi_source_get_height;
+
+	return ndi_gpu_source_info;
+}
@@ -39,6 +39,9 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include "plugin-main.h"
 #include "main-output.h"
+#include "ndi-discovery.h"
+#include "ndi-metadata.h"
+#include "ndi-worker-pool.h"
 #include "preview-output.h"
 #include "Config.h"
 #include "forms/output-settings.h"
@@ -60,6 +63,14 @@ const NDIlib_v4 *ndiLib = nullptr;
 
 extern struct obs_source_info create_ndi_source_info();
 struct obs_source_info ndi_source_info;
+extern void ndi_source_scene_tracking_start();
+extern void ndi_source_scene_tracking_stop();
+
+extern struct obs_source_info create_ndi_gpu_source_info();
+struct obs_source_info ndi_gpu_source_info;
+
+extern struct obs_source_info create_ndi_multiviewer_info();
+struct obs_source_info ndi_multiviewer_info;
 
 extern struct obs_output_info create_ndi_output_info();
 struct obs_output_info ndi_output_info;
@@ -78,8 +89,6 @@ const NDIlib_v5 *load_ndilib();
 typedef const NDIlib_v5 *(*NDIlib_v5_load_)(void);
 QLibrary *loaded_lib = nullptr;
 
-NDIlib_find_instance_t ndi_finder = nullptr;
-
 OutputSettings *output_settings = nullptr;
 
 bool obs_module_load(void)
@@ -133,13 +142,17 @@ bool obs_module_load(void)
 	     "[obs-ndi] obs_module_load: NDI library initialized successfully ('%s')",
 	     ndiLib->version());
 
-	NDIlib_find_create_t find_desc = {0};
-	find_desc.show_local_sources = true;
-	find_desc.p_groups = NULL;
-	ndi_finder = ndiLib->find_create_v2(&find_desc);
+	ndi_discovery_start();
 
 	ndi_source_info = create_ndi_source_info();
 	obs_register_source(&ndi_source_info);
+	ndi_source_scene_tracking_start();
+
+	ndi_gpu_source_info = create_ndi_gpu_source_info();
+	obs_register_source(&ndi_gpu_source_info);
+
+	ndi_multiviewer_info = create_ndi_multiviewer_info();
+	obs_register_source(&ndi_multiviewer_info);
 
 	ndi_output_info = create_ndi_output_info();
 	obs_register_output(&ndi_output_info);
@@ -231,11 +244,13 @@ void obs_module_unload(void)
 {
 	blog(LOG_INFO, "[obs-ndi] +obs_module_unload()");
 
+	// Sources are gone by now, and with them all receiver tasks
+	ndi_worker_pool_shutdown();
+	ndi_metadata_shutdown();
+
 	if (ndiLib) {
-		if (ndi_finder) {
-			ndiLib->find_destroy(ndi_finder);
-			ndi_finder = nullptr;
-		}
+		ndi_source_scene_tracking_stop();
+		ndi_discovery_stop();
 		ndiLib->destroy();
 		ndiLib = nullptr;
 	}